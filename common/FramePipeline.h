@@ -1,48 +1,341 @@
 #pragma once
 
-#include <vector>
+#include "FrameQueue.h"
+#include "ThreadConfig.h"
+#include "profiling/AllocationCounter.h"
+#include "profiling/PipelineStats.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <functional>
 #include <memory>
+#include <thread>
+#include <vector>
 
 template<typename FrameT>
 class FramePipeline
 {
 public:
+    using FramePtr = std::shared_ptr<FrameT>;
+    using FrameHandler = std::function<void(const FramePtr&)>;
+
     class IComponent
     {
     public:
+        virtual ~IComponent() = default;
+
+        // Returning nullptr drops the frame, later components are skipped
         virtual std::shared_ptr<FrameT> process_frame(const std::shared_ptr<FrameT>&) = 0;
+
+        // Components that modify the frame they are given return true, the
+        // pipeline then hands them a private copy whenever the frame is also
+        // referenced elsewhere, e.g. by another branch
+        virtual bool mutates_frame() const
+        {
+            return false;
+        }
     };
 
     struct ComponentHolder
     {
         IComponent *ptr;
         bool should_free;
+        std::unique_ptr<ComponentStats> stats;
     };
 
-    FramePipeline() = default;
+    // Input queue of a stage, only used once the pipeline is started
+    struct StageConfig
+    {
+        size_t queue_size{4};
+        Backpressure backpressure{Backpressure::BLOCK};
+    };
+
+    FramePipeline(const StageConfig &config = {})
+    {
+        _stages.push_back({0, config, nullptr, {}});
+    }
+
+    FramePipeline(FramePipeline&&) = default;
+    FramePipeline& operator=(FramePipeline&&) = default;
+
+    ~FramePipeline()
+    {
+        stop();
+
+        for (auto &[component, should_free, _] : _components)
+        {
+            if (should_free)
+                delete component;
+        }
+    }
 
     void add_component(IComponent *component)
     {
-        _components.push_back({component, false});
+        _components.push_back({component, false, make_stats(*component)});
     }
 
     template<typename ComponentT, typename... Args>
-    void make_component(Args&&... args)
+    ComponentT& make_component(Args&&... args)
     {
-        _components.push_back({new ComponentT(std::forward<Args>(args)...), true});
+        auto *component = new ComponentT(std::forward<Args>(args)...);
+        _components.push_back({component, true, make_stats(*component)});
+
+        return *component;
     }
 
+    // Components added after this call run on a separate thread once the
+    // pipeline is started
+    void add_stage(const StageConfig &config = {})
+    {
+        _stages.push_back({_components.size(), config, nullptr, {}});
+    }
+
+    // Frames leaving the last component are shared with every branch. A
+    // branch is a pipeline of its own, when started it runs on its own
+    // threads and its first stage's queue decides what happens when it
+    // falls behind, without stalling the other branches.
+    FramePipeline& add_branch(const StageConfig &config = {})
+    {
+        _branches.push_back(std::make_unique<FramePipeline>(config));
+        _branches.back()->_profiling = _profiling;
+
+        return *_branches.back();
+    }
+
+    void set_output_handler(const FrameHandler &handler)
+    {
+        _output_handler = handler;
+    }
+
+    // Runs every component on the caller's thread, stage boundaries are
+    // ignored. The result is also pushed to the branches.
     std::shared_ptr<FrameT> process_frame(std::shared_ptr<FrameT> frame)
     {
-        for (auto &[component, _] : _components)
+        frame = run_components(std::move(frame), 0, _components.size());
+
+        if (frame)
         {
-            frame = component->process_frame(frame);
+            for (auto &branch : _branches)
+            {
+                branch->push_frame(frame);
+            }
         }
 
         return frame;
     }
 
+    // Spawns one thread per stage, frames submitted with push_frame are
+    // delivered to the branches and the output handler from the last
+    // stage's thread. Branches are started as well.
+    void start()
+    {
+        if (_running)
+            return;
+
+        for (auto &branch : _branches)
+        {
+            branch->start();
+        }
+
+        for (auto &stage : _stages)
+        {
+            stage.queue = std::make_unique<FrameQueue<FramePtr>>(stage.config.queue_size, stage.config.backpressure);
+        }
+
+        for (size_t i = 0; i < _stages.size(); i++)
+        {
+            _stages[i].thread = std::thread([this, i](){ run_stage(i); });
+        }
+
+        _running = true;
+    }
+
+    // Drains every stage in order and joins the stage threads
+    void stop()
+    {
+        if (!_running)
+            return;
+
+        _stages.front().queue->close();
+
+        for (auto &stage : _stages)
+        {
+            stage.thread.join();
+        }
+
+        for (auto &branch : _branches)
+        {
+            branch->stop();
+        }
+
+        _running = false;
+    }
+
+    // Returns false if the frame was dropped by the first stage's queue. When
+    // the pipeline is not started the frame is processed synchronously.
+    bool push_frame(std::shared_ptr<FrameT> frame)
+    {
+        if (auto &queue = _stages.front().queue; queue)
+            return queue->push(std::move(frame));
+
+        if (frame = run_components(std::move(frame), 0, _components.size()); frame)
+            emit(frame);
+
+        return true;
+    }
+
+    size_t num_stages() const
+    {
+        return _stages.size();
+    }
+
+    size_t stage_queue_depth(size_t stage) const
+    {
+        const auto &queue = _stages.at(stage).queue;
+
+        return queue ? queue->size() : 0;
+    }
+
+    uint64_t stage_dropped_frames(size_t stage) const
+    {
+        const auto &queue = _stages.at(stage).queue;
+
+        return queue ? queue->dropped() : 0;
+    }
+
+    // Times every process_frame call and counts bytes and heap allocations
+    // per component, set before starting the pipeline
+    void enable_profiling(bool enable = true)
+    {
+        _profiling = enable;
+
+        for (auto &branch : _branches)
+        {
+            branch->enable_profiling(enable);
+        }
+    }
+
+    std::vector<ComponentStats::Snapshot> get_stats() const
+    {
+        std::vector<ComponentStats::Snapshot> ret;
+
+        for (const auto &holder : _components)
+        {
+            ret.push_back(holder.stats->snapshot());
+        }
+
+        return ret;
+    }
+
+    void dump_stats(FILE *fp) const
+    {
+        print_stats_header(fp);
+
+        for (const auto &stats : get_stats())
+        {
+            print_stats(fp, stats);
+        }
+
+        for (size_t i = 0; i < _stages.size(); i++)
+        {
+            fprintf(fp, "stage %zu: queue %zu, dropped %" PRIu64 "\n", i, stage_queue_depth(i), stage_dropped_frames(i));
+        }
+
+        for (size_t i = 0; i < _branches.size(); i++)
+        {
+            fprintf(fp, "branch %zu:\n", i);
+            _branches[i]->dump_stats(fp);
+        }
+    }
+
 private:
+    struct Stage
+    {
+        size_t first_component;
+        StageConfig config;
+        std::unique_ptr<FrameQueue<FramePtr>> queue;
+        std::thread thread;
+    };
+
     std::vector<ComponentHolder> _components;
-};
+    std::vector<Stage> _stages;
+    std::vector<std::unique_ptr<FramePipeline>> _branches;
+    FrameHandler _output_handler;
+    bool _running{false};
+    bool _profiling{false};
+
+    static std::unique_ptr<ComponentStats> make_stats(const IComponent &component)
+    {
+        return std::make_unique<ComponentStats>(demangled_type_name(typeid(component)));
+    }
+
+    std::shared_ptr<FrameT> run_components(std::shared_ptr<FrameT> frame, size_t first, size_t last)
+    {
+        for (size_t i = first; i < last && frame; i++)
+        {
+            auto &[component, _, stats] = _components[i];
+
+            if (frame.use_count() > 1 && component->mutates_frame())
+                frame = std::make_shared<FrameT>(*frame);
+
+            if (!_profiling)
+            {
+                frame = component->process_frame(frame);
+                continue;
+            }
+
+            uint64_t bytes_in = frame->buffer.size();
+            uint64_t allocs = thread_allocation_count();
+            auto t0 = std::chrono::steady_clock::now();
+
+            frame = component->process_frame(frame);
+
+            auto t1 = std::chrono::steady_clock::now();
+            allocs = thread_allocation_count() - allocs;
+
+            stats->record(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count(),
+                    bytes_in, frame ? frame->buffer.size() : 0, allocs);
+        }
+
+        return frame;
+    }
+
+    void emit(const std::shared_ptr<FrameT> &frame)
+    {
+        for (auto &branch : _branches)
+        {
+            branch->push_frame(frame);
+        }
+
+        if (_output_handler)
+            _output_handler(frame);
+    }
+
+    void run_stage(size_t idx)
+    {
+        configure_current_thread("stage" + std::to_string(idx));
+
+        auto &stage = _stages[idx];
+        size_t last = idx + 1 < _stages.size() ? _stages[idx + 1].first_component : _components.size();
+
+        FramePtr frame;
 
+        while (stage.queue->pop(frame))
+        {
+            frame = run_components(std::move(frame), stage.first_component, last);
+
+            if (!frame)
+                continue;
+
+            if (idx + 1 < _stages.size())
+                _stages[idx + 1].queue->push(std::move(frame));
+            else
+                emit(frame);
+
+            frame = nullptr;
+        }
+
+        if (idx + 1 < _stages.size())
+            _stages[idx + 1].queue->close();
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "VideoFrame.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Recycles frames and their buffers. A frame goes back to the pool when the
+// last reference to it is dropped, so handed out frames look like any other
+// to the pipeline's copy-on-write. The pool may be destroyed before its
+// frames.
+class FramePool
+{
+public:
+    // Up to max_free returned frames are kept for reuse
+    FramePool(size_t max_free = 8):
+        _state(std::make_shared<State>())
+    {
+        _state->max_free = max_free;
+    }
+
+    // Buffer resized to size, everything else reset
+    auto acquire(size_t size) -> VideoFramePtr
+    {
+        std::unique_ptr<VideoFrame> frame;
+
+        {
+            std::lock_guard<std::mutex> lock(_state->mtx);
+
+            if (!_state->free.empty())
+            {
+                frame = std::move(_state->free.back());
+                _state->free.pop_back();
+            }
+            else
+            {
+                _state->allocated++;
+            }
+        }
+
+        if (frame)
+        {
+            // Keeps the buffer's capacity
+            std::vector<uint8_t> buffer = std::move(frame->buffer);
+            *frame = VideoFrame{};
+            frame->buffer = std::move(buffer);
+        }
+        else
+        {
+            frame = std::make_unique<VideoFrame>();
+        }
+
+        frame->buffer.resize(size);
+
+        return VideoFramePtr(frame.release(), [state = _state](VideoFrame *frame) {
+            std::lock_guard<std::mutex> lock(state->mtx);
+
+            if (state->free.size() < state->max_free)
+                state->free.emplace_back(frame);
+            else
+                delete frame;
+        });
+    }
+
+    // Frames created so far, stays flat once the pool is warm
+    auto allocated() const -> size_t
+    {
+        std::lock_guard<std::mutex> lock(_state->mtx);
+
+        return _state->allocated;
+    }
+
+private:
+    struct State
+    {
+        std::mutex mtx;
+        std::vector<std::unique_ptr<VideoFrame>> free;
+        size_t max_free;
+        size_t allocated{0};
+    };
+
+    std::shared_ptr<State> _state;
+};
+
+// From the pool when there is one, a new frame otherwise
+inline auto acquire_frame(FramePool *pool, size_t size = 0) -> VideoFramePtr
+{
+    if (pool)
+        return pool->acquire(size);
+
+    auto ret = std::make_shared<VideoFrame>();
+    ret->buffer.resize(size);
+
+    return ret;
+}
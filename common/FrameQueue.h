@@ -0,0 +1,282 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+enum class Backpressure
+{
+    BLOCK,
+    DROP_OLDEST,
+    DROP_NEWEST,
+};
+
+// Bounded lock-free ring for handing items from one producer thread to one
+// consumer thread, capacity is rounded up to a power of two. Every slot
+// carries a sequence number, so a slot is only reused once the consumer has
+// moved its item out. With DROP_OLDEST the producer evicts from the head
+// itself, which is why the head is claimed with a CAS.
+//
+// A thread that has to wait spins briefly, then parks on a condition
+// variable. The other side only takes the lock to wake it when somebody is
+// parked, so the uncontended path stays lock-free.
+template<typename T>
+class FrameQueue
+{
+public:
+    FrameQueue(size_t capacity, Backpressure backpressure = Backpressure::BLOCK):
+        _capacity(round_up_pow2(capacity ? capacity : 1)),
+        _mask(_capacity - 1),
+        _backpressure(backpressure),
+        _slots(new Slot[_capacity]),
+        _head(0),
+        _tail(0),
+        _closed(false),
+        _dropped(0)
+    {
+        for (size_t i = 0; i < _capacity; i++)
+        {
+            _slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    // Returns false if the item was not enqueued, either because the queue is
+    // closed or because it was full under DROP_NEWEST.
+    auto push(T item) -> bool
+    {
+        size_t spins = 0;
+
+        while (!try_push(item))
+        {
+            if (_closed.load(std::memory_order_acquire))
+                return false;
+
+            switch (_backpressure)
+            {
+            case Backpressure::DROP_NEWEST:
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case Backpressure::DROP_OLDEST:
+                if (T evicted; try_pop(evicted))
+                {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                break;
+            case Backpressure::BLOCK:
+                if (spins >= spin_limit)
+                {
+                    park([this](){ return can_push() || closed(); });
+                    continue;
+                }
+                break;
+            }
+
+            spin(spins++);
+        }
+
+        return true;
+    }
+
+    auto try_push(T &item) -> bool
+    {
+        if (_closed.load(std::memory_order_acquire))
+            return false;
+
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        Slot &slot = _slots[pos & _mask];
+
+        if (slot.seq.load(std::memory_order_acquire) != pos)
+            return false;
+
+        slot.value = std::move(item);
+        slot.seq.store(pos + 1, std::memory_order_release);
+        _tail.store(pos + 1, std::memory_order_release);
+
+        wake();
+
+        return true;
+    }
+
+    // Blocks until an item is available. Returns false once the queue has been
+    // closed and drained.
+    auto pop(T &item) -> bool
+    {
+        size_t spins = 0;
+
+        while (!try_pop(item))
+        {
+            if (_closed.load(std::memory_order_acquire) && empty())
+                return false;
+
+            if (spins >= spin_limit)
+                park([this](){ return !empty() || closed(); });
+            else
+                spin(spins++);
+        }
+
+        return true;
+    }
+
+    auto try_pop(T &item) -> bool
+    {
+        size_t pos = _head.load(std::memory_order_relaxed);
+        Slot *slot;
+
+        while (1)
+        {
+            slot = &_slots[pos & _mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (diff == 0)
+            {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+
+        item = std::move(slot->value);
+        slot->value = T{};
+        slot->seq.store(pos + _capacity, std::memory_order_release);
+
+        wake();
+
+        return true;
+    }
+
+    auto close() -> void
+    {
+        _closed.store(true, std::memory_order_release);
+
+        std::lock_guard<std::mutex> lock(_park_mtx);
+        _park_cv.notify_all();
+    }
+
+    auto closed() const -> bool
+    {
+        return _closed.load(std::memory_order_acquire);
+    }
+
+    auto size() const -> size_t
+    {
+        size_t tail = _tail.load(std::memory_order_acquire);
+        size_t head = _head.load(std::memory_order_acquire);
+
+        return tail > head ? tail - head : 0;
+    }
+
+    auto empty() const -> bool
+    {
+        return size() == 0;
+    }
+
+    auto capacity() const -> size_t
+    {
+        return _capacity;
+    }
+
+    auto dropped() const -> uint64_t
+    {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    static auto round_up_pow2(size_t n) -> size_t
+    {
+        size_t ret = 1;
+
+        while (ret < n)
+            ret <<= 1;
+
+        return ret;
+    }
+
+    // A few microseconds at most, anything longer is cheaper to sleep on
+    static constexpr size_t spin_limit = 32;
+
+    // Busy waits without giving up the CPU, yielding would starve same-CPU
+    // threads of lower priority under SCHED_FIFO
+    static auto spin(size_t) -> void
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+    }
+
+    // Only ever called by the producer
+    auto can_push() const -> bool
+    {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+
+        return _slots[pos & _mask].seq.load(std::memory_order_acquire) == pos;
+    }
+
+    // The fences pair with the one in wake(): either the waker sees the
+    // parked flag or the parked thread sees the new state. The flag is
+    // raised again before every wait, a wake-up can be for the other side.
+    template<typename Pred>
+    auto park(Pred pred) -> void
+    {
+        std::unique_lock<std::mutex> lock(_park_mtx);
+
+        while (1)
+        {
+            _parked.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (pred())
+                break;
+
+            _park_cv.wait(lock);
+        }
+    }
+
+    // Takes the lock only when somebody may be parked, once per parking
+    auto wake() -> void
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!_parked.load(std::memory_order_relaxed) || !_parked.exchange(false, std::memory_order_relaxed))
+            return;
+
+        std::lock_guard<std::mutex> lock(_park_mtx);
+        _park_cv.notify_all();
+    }
+
+    const size_t _capacity;
+    const size_t _mask;
+    const Backpressure _backpressure;
+    std::unique_ptr<Slot[]> _slots;
+
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+    alignas(64) std::atomic<bool> _closed;
+    std::atomic<uint64_t> _dropped;
+
+    alignas(64) std::atomic<bool> _parked{false};
+    std::mutex _park_mtx;
+    std::condition_variable _park_cv;
+};
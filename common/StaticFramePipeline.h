@@ -0,0 +1,193 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "VideoFrame.h"
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// How a stage type plugs into StaticFramePipeline, detected at compile time.
+//
+// Block stage: works on runs of 16-bit samples in place,
+//     auto process_block(uint16_t *px, size_t offset, size_t count) -> void
+// with an optional begin_frame(VideoFrame&) called once per frame before the
+// first block. offset is the index of px[0] within the frame. Adjacent block
+// stages are fused, so the frame is walked once in cache-sized blocks instead
+// of once per stage. begin_frame must not depend on pixel values written by
+// an earlier stage of the same run. Frames that aren't 16-bit are handed to
+// each block stage's process_frame instead.
+//
+// In-place stage: auto process_frame_in_place(VideoFrame&) -> void
+//
+// Anything else is called as process_frame(const VideoFramePtr&), which makes
+// every FramePipeline component usable as a stage.
+template<typename StageT>
+struct StageTraits
+{
+    template<typename T>
+    static auto test_block(int) -> decltype(std::declval<T&>().process_block((uint16_t*)nullptr, size_t{}, size_t{}), std::true_type{});
+    template<typename T>
+    static auto test_block(...) -> std::false_type;
+
+    template<typename T>
+    static auto test_begin_frame(int) -> decltype(std::declval<T&>().begin_frame(std::declval<VideoFrame&>()), std::true_type{});
+    template<typename T>
+    static auto test_begin_frame(...) -> std::false_type;
+
+    template<typename T>
+    static auto test_in_place(int) -> decltype(std::declval<T&>().process_frame_in_place(std::declval<VideoFrame&>()), std::true_type{});
+    template<typename T>
+    static auto test_in_place(...) -> std::false_type;
+
+    static constexpr bool is_block = decltype(test_block<StageT>(0))::value;
+    static constexpr bool has_begin_frame = decltype(test_begin_frame<StageT>(0))::value;
+    static constexpr bool is_in_place = !is_block && decltype(test_in_place<StageT>(0))::value;
+};
+
+// Fixed pipeline with the stages stored inline and dispatched statically. The
+// frame pointer is passed by reference between stages, so the refcount is
+// only touched by stages that return a new frame.
+template<typename... Stages>
+class StaticFramePipeline : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    // Number of samples a fused run processes through all its stages before
+    // moving on, sized to stay in L1
+    static constexpr size_t fuse_block_size = 2048;
+
+    StaticFramePipeline() = default;
+
+    // Each stage is constructed from the matching argument, so stages that
+    // can't be moved can be built in place from their config
+    template<typename... Args, typename = std::enable_if_t<sizeof...(Args) == sizeof...(Stages)>>
+    explicit StaticFramePipeline(Args&&... args):
+        _stages(std::forward<Args>(args)...)
+    {
+    }
+
+    template<size_t I>
+    auto stage() -> std::tuple_element_t<I, std::tuple<Stages...>>&
+    {
+        return std::get<I>(_stages);
+    }
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override
+    {
+        if (!frame)
+            return nullptr;
+
+        VideoFramePtr ret = frame;
+        run<0>(ret);
+
+        return ret;
+    }
+
+    auto mutates_frame() const -> bool override
+    {
+        return std::apply([](const auto&... stages){ return (stage_mutates_frame(stages) || ...); }, _stages);
+    }
+
+private:
+    std::tuple<Stages...> _stages;
+
+    template<typename StageT>
+    static auto stage_mutates_frame(const StageT &stage) -> bool
+    {
+        if constexpr (StageTraits<StageT>::is_block || StageTraits<StageT>::is_in_place)
+            return true;
+        else if constexpr (std::is_base_of_v<FramePipeline<VideoFrame>::IComponent, StageT>)
+            return stage.mutates_frame();
+        else
+            return false;
+    }
+
+    template<size_t I>
+    using StageAt = std::tuple_element_t<I, std::tuple<Stages...>>;
+
+    template<size_t I>
+    static constexpr auto block_run_end() -> size_t
+    {
+        if constexpr (I < sizeof...(Stages))
+        {
+            if constexpr (StageTraits<StageAt<I>>::is_block)
+                return block_run_end<I + 1>();
+        }
+
+        return I;
+    }
+
+    template<size_t I>
+    auto run(VideoFramePtr &frame) -> void
+    {
+        if constexpr (I < sizeof...(Stages))
+        {
+            using Traits = StageTraits<StageAt<I>>;
+
+            if constexpr (Traits::is_block)
+            {
+                constexpr size_t last = block_run_end<I>();
+
+                if (frame->format.bits_per_pixel == 16)
+                {
+                    run_fused<I>(*frame, std::make_index_sequence<last - I>{});
+                    run<last>(frame);
+                }
+                else
+                {
+                    run_unfused<I, last>(frame);
+                }
+            }
+            else if constexpr (Traits::is_in_place)
+            {
+                std::get<I>(_stages).process_frame_in_place(*frame);
+                run<I + 1>(frame);
+            }
+            else
+            {
+                if (frame = std::get<I>(_stages).process_frame(frame); frame)
+                    run<I + 1>(frame);
+            }
+        }
+    }
+
+    // Block stages one after the other, each on the whole frame
+    template<size_t I, size_t Last>
+    auto run_unfused(VideoFramePtr &frame) -> void
+    {
+        if constexpr (I < Last)
+        {
+            if (frame = std::get<I>(_stages).process_frame(frame); frame)
+                run_unfused<I + 1, Last>(frame);
+        }
+        else
+        {
+            run<Last>(frame);
+        }
+    }
+
+    template<size_t First, size_t... Is>
+    auto run_fused(VideoFrame &frame, std::index_sequence<Is...>) -> void
+    {
+        (begin_frame<First + Is>(frame), ...);
+
+        auto *px = (uint16_t*)frame.buffer.data();
+        size_t count = std::min<size_t>(frame.buffer.size() / sizeof(uint16_t),
+                (size_t)frame.format.width * frame.format.height * frame.format.num_components);
+
+        for (size_t offset = 0; offset < count; offset += fuse_block_size)
+        {
+            size_t n = std::min(fuse_block_size, count - offset);
+
+            (std::get<First + Is>(_stages).process_block(px + offset, offset, n), ...);
+        }
+    }
+
+    template<size_t I>
+    auto begin_frame(VideoFrame &frame) -> void
+    {
+        if constexpr (StageTraits<StageAt<I>>::has_begin_frame)
+            std::get<I>(_stages).begin_frame(frame);
+    }
+};
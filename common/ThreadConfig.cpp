@@ -0,0 +1,283 @@
+#include "ThreadConfig.h"
+#include <algorithm>
+#include <cstring>
+#include <err.h>
+#include <fstream>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+
+namespace
+{
+
+struct ThreadEntry
+{
+    std::string name;
+    pid_t tid;
+    clockid_t clock;
+    std::vector<int> cpus;
+    int fifo_priority;
+};
+
+std::mutex config_mtx;
+std::vector<std::pair<std::string, ThreadSettings>> config;
+std::vector<ThreadEntry*> threads;
+
+// Parses a kernel CPU list such as "0-3,8,10-11"
+auto parse_cpu_list(const std::string &list) -> std::vector<int>
+{
+    std::vector<int> ret;
+    std::istringstream ranges(list);
+
+    for (std::string range; std::getline(ranges, range, ',');)
+    {
+        int first, last;
+
+        if (int n = sscanf(range.c_str(), "%d-%d", &first, &last); n == 1)
+            ret.push_back(first);
+        else if (n == 2)
+        {
+            for (int cpu = first; cpu <= last; cpu++)
+                ret.push_back(cpu);
+        }
+    }
+
+    return ret;
+}
+
+auto numa_node_cpus(int node) -> std::vector<int>
+{
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+
+    if (!std::getline(file, list))
+    {
+        warnx("no NUMA node %d", node);
+        return {};
+    }
+
+    return parse_cpu_list(list);
+}
+
+auto parse_entry(const std::string &line) -> bool
+{
+    std::istringstream tokens(line);
+    std::string name;
+
+    if (!(tokens >> name) || name[0] == '#')
+        return true;
+
+    ThreadSettings settings;
+
+    for (std::string token; tokens >> token;)
+    {
+        auto eq = token.find('=');
+
+        if (eq == std::string::npos)
+        {
+            warnx("thread config: expected key=value, got '%s'", token.c_str());
+            return false;
+        }
+
+        auto key = token.substr(0, eq);
+        auto value = token.substr(eq + 1);
+
+        if (key == "cpus")
+        {
+            auto cpus = parse_cpu_list(value);
+            settings.cpus.insert(settings.cpus.end(), cpus.begin(), cpus.end());
+        }
+        else if (key == "numa")
+        {
+            settings.numa_node = std::stoi(value);
+
+            auto cpus = numa_node_cpus(settings.numa_node);
+            settings.cpus.insert(settings.cpus.end(), cpus.begin(), cpus.end());
+        }
+        else if (key == "fifo")
+        {
+            settings.fifo_priority = std::stoi(value);
+
+            if (settings.fifo_priority < 1 || settings.fifo_priority > 99)
+            {
+                warnx("thread config: fifo priority must be between 1 and 99");
+                return false;
+            }
+        }
+        else
+        {
+            warnx("thread config: unknown key '%s'", key.c_str());
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(config_mtx);
+    config.emplace_back(name, std::move(settings));
+
+    return true;
+}
+
+auto find_settings(const std::string &name) -> const ThreadSettings*
+{
+    for (const auto &[pattern, settings] : config)
+    {
+        if (pattern.back() == '*' ? name.compare(0, pattern.size() - 1, pattern, 0, pattern.size() - 1) == 0
+                : name == pattern)
+            return &settings;
+    }
+
+    return nullptr;
+}
+
+auto set_affinity(const std::vector<int> &cpus) -> bool
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+}
+
+// Unregisters the thread when it exits, its CPU clock is invalid after that
+struct ThreadRegistration
+{
+    ThreadEntry entry{};
+    bool registered{false};
+
+    ~ThreadRegistration()
+    {
+        if (!registered)
+            return;
+
+        std::lock_guard<std::mutex> lock(config_mtx);
+        threads.erase(std::remove(threads.begin(), threads.end(), &entry), threads.end());
+    }
+};
+
+thread_local ThreadRegistration registration;
+
+}
+
+auto load_thread_config(const std::string &spec) -> bool
+{
+    std::ifstream file(spec);
+    std::string contents;
+
+    if (file)
+    {
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        contents = spec;
+        std::replace(contents.begin(), contents.end(), ';', '\n');
+    }
+
+    std::istringstream lines(contents);
+
+    for (std::string line; std::getline(lines, line);)
+    {
+        if (!parse_entry(line))
+            return false;
+    }
+
+    return true;
+}
+
+auto configure_current_thread(const std::string &name) -> void
+{
+    // The kernel keeps 15 characters of it
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+    std::lock_guard<std::mutex> lock(config_mtx);
+
+    auto &entry = registration.entry;
+    entry.name = name;
+    entry.tid = syscall(SYS_gettid);
+
+    if (pthread_getcpuclockid(pthread_self(), &entry.clock) != 0)
+        entry.clock = CLOCK_THREAD_CPUTIME_ID;
+
+    if (!registration.registered)
+    {
+        threads.push_back(&entry);
+        registration.registered = true;
+    }
+
+    const auto *settings = find_settings(name);
+
+    if (!settings)
+        return;
+
+    if (!settings->cpus.empty())
+    {
+        if (set_affinity(settings->cpus))
+            entry.cpus = settings->cpus;
+        else
+            warnx("%s: cannot set CPU affinity", name.c_str());
+    }
+
+    if (settings->fifo_priority)
+    {
+        sched_param param{};
+        param.sched_priority = settings->fifo_priority;
+
+        if (int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param); ret == 0)
+            entry.fifo_priority = settings->fifo_priority;
+        else
+            warnx("%s: cannot set SCHED_FIFO (%s)", name.c_str(), strerror(ret));
+    }
+}
+
+auto pin_current_thread(int cpu) -> bool
+{
+    if (!set_affinity({cpu}))
+        return false;
+
+    std::lock_guard<std::mutex> lock(config_mtx);
+
+    if (registration.registered)
+        registration.entry.cpus = {cpu};
+
+    return true;
+}
+
+auto lock_memory() -> bool
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        warn("mlockall");
+        return false;
+    }
+
+    return true;
+}
+
+auto dump_thread_stats(FILE *fp) -> void
+{
+    std::lock_guard<std::mutex> lock(config_mtx);
+
+    fprintf(fp, "%-16s %8s %12s %6s %s\n", "thread", "tid", "cpu_ms", "fifo", "cpus");
+
+    for (const auto *entry : threads)
+    {
+        timespec ts{};
+        clock_gettime(entry->clock, &ts);
+
+        std::string cpus;
+
+        for (int cpu : entry->cpus)
+            cpus += (cpus.empty() ? "" : ",") + std::to_string(cpu);
+
+        fprintf(fp, "%-16s %8d %12.1f %6d %s\n", entry->name.c_str(), (int)entry->tid,
+                ts.tv_sec * 1e3 + ts.tv_nsec / 1e6, entry->fifo_priority, cpus.empty() ? "any" : cpus.c_str());
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Placement and scheduling of a named thread, threads without settings keep
+// the default policy and may run on any CPU
+struct ThreadSettings
+{
+    std::vector<int> cpus;
+    int numa_node{-1}; // adds the node's CPUs
+    int fifo_priority{0}; // 1-99 runs the thread SCHED_FIFO
+};
+
+// Reads thread settings from a file, or from the string itself when it is
+// not a file. One thread per line or per ';' separated entry:
+//     uvc-handler cpus=2,3 fifo=50
+//     stage* numa=1
+// A name ending in '*' matches every thread name starting with it, the first
+// matching entry wins.
+auto load_thread_config(const std::string &spec) -> bool;
+
+// Names the calling thread, applies its settings and tracks its CPU time
+// until it exits. Calling it again renames the thread.
+auto configure_current_thread(const std::string &name) -> void;
+
+// Pins the calling thread to one CPU, returns false if that failed
+auto pin_current_thread(int cpu) -> bool;
+
+// Keeps every current and future page resident, so frame buffers never fault
+auto lock_memory() -> bool;
+
+// CPU time, placement and policy of every configured thread still running
+auto dump_thread_stats(FILE *fp) -> void;
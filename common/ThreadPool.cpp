@@ -0,0 +1,67 @@
+#include "ThreadPool.h"
+#include "ThreadConfig.h"
+
+ThreadPool::ThreadPool(size_t num_threads):
+    _stop(false)
+{
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        _workers.emplace_back([this](){ worker(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+    }
+
+    _cv.notify_all();
+
+    for (auto &thread : _workers)
+    {
+        thread.join();
+    }
+}
+
+auto ThreadPool::num_threads() const -> size_t
+{
+    return _workers.size();
+}
+
+auto ThreadPool::submit(Task task) -> void
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _tasks.push_back(std::move(task));
+    }
+
+    _cv.notify_one();
+}
+
+auto ThreadPool::worker() -> void
+{
+    configure_current_thread("pool");
+
+    while (1)
+    {
+        Task task;
+
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _cv.wait(lock, [this](){ return _stop || !_tasks.empty(); });
+
+            if (_tasks.empty())
+                return;
+
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    // 0 picks one thread per core
+    ThreadPool(size_t num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    auto num_threads() const -> size_t;
+    auto submit(Task task) -> void;
+
+    // Calls func(i) for every i in [0, count) across the pool and the calling
+    // thread, returns once all calls are done
+    template<typename F>
+    auto parallel_for(size_t count, F &&func) -> void
+    {
+        if (count == 0)
+            return;
+
+        if (count == 1 || _workers.empty())
+        {
+            for (size_t i = 0; i < count; i++)
+                func(i);
+
+            return;
+        }
+
+        struct Job
+        {
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> done{0};
+            std::mutex mtx;
+            std::condition_variable cv;
+        };
+
+        auto job = std::make_shared<Job>();
+        size_t num_helpers = std::min(count - 1, _workers.size());
+
+        auto run = [job, count, &func](){
+            for (size_t i; (i = job->next.fetch_add(1)) < count;)
+            {
+                func(i);
+
+                if (job->done.fetch_add(1) + 1 == count)
+                {
+                    std::lock_guard<std::mutex> lock(job->mtx);
+                    job->cv.notify_all();
+                }
+            }
+        };
+
+        for (size_t i = 0; i < num_helpers; i++)
+        {
+            submit(run);
+        }
+
+        run();
+
+        std::unique_lock<std::mutex> lock(job->mtx);
+        job->cv.wait(lock, [&](){ return job->done.load() == count; });
+    }
+
+private:
+    std::vector<std::thread> _workers;
+    std::deque<Task> _tasks;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _stop;
+
+    auto worker() -> void;
+};
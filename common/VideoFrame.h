@@ -16,12 +16,75 @@ struct VideoFrame
 		uint16_t bits_per_pixel;
 	} format;
 
+	struct Rect
+	{
+		uint16_t x;
+		uint16_t y;
+		uint16_t width;
+		uint16_t height;
+
+		auto operator==(const Rect &other) const -> bool
+		{
+			return x == other.x && y == other.y && width == other.width && height == other.height;
+		}
+	};
+
 	enum class Compression
 	{
 		NONE = 0,
 		JPEG_LS,
 		JPEG_XL,
+		PACKED, // raw samples bit-packed to bits_per_pixel, see BitPacker
 	} compression{Compression::NONE};
+
+	// How samples of bits_per_pixel width are interpreted. Kept out of
+	// Format, which is sent as is over the wire and into recordings.
+	enum class SampleType
+	{
+		UINT = 0,
+		FLOAT,
+	} sample_type{SampleType::UINT};
+
+	// Position within the full frame when this frame is a crop of it
+	uint16_t origin_x{0};
+	uint16_t origin_y{0};
+
+	struct Metadata
+	{
+		uint64_t sequence;
+		uint64_t capture_time_ns; // CLOCK_REALTIME
+		uint64_t send_time_ns;
+		uint64_t recv_time_ns;
+
+		// Sensor telemetry rows split off the image, kept raw in the buffer
+		uint16_t telemetry_rows;
+		uint32_t telemetry_offset;
+		uint32_t telemetry_size;
+
+		// Of the image samples as stored
+		bool has_stats;
+		float min;
+		float max;
+		float mean;
+	} metadata{};
+
+	auto telemetry() const -> const uint8_t*
+	{
+		return metadata.telemetry_size ? buffer.data() + metadata.telemetry_offset : nullptr;
+	}
+
+	// For components that make a new frame out of src: takes over its
+	// metadata and appends its telemetry behind the current buffer contents
+	auto inherit_metadata(const VideoFrame &src) -> void
+	{
+		metadata = src.metadata;
+
+		if (!metadata.telemetry_size)
+			return;
+
+		metadata.telemetry_offset = buffer.size();
+		buffer.insert(buffer.end(), src.telemetry(), src.telemetry() + src.metadata.telemetry_size);
+	}
 };
 
 using VideoFramePtr = std::shared_ptr<VideoFrame>;
@@ -0,0 +1,316 @@
+#include "compression/BitPack.h"
+#include "simd/Simd.h"
+#include <algorithm>
+#include <cstring>
+#include <err.h>
+
+using u64 = uint64_t __attribute__((vector_size(simd::width)));
+
+// Groups of four samples fill 4 * bits bits of a 64-bit lane, which is a
+// whole number of bytes for even depths. Lanes are stored with 8-byte
+// writes that overlap, each one overwriting the unused top of the previous.
+static auto pack_scalar(const uint16_t *src, size_t count, uint16_t bits, uint8_t *dst) -> void
+{
+    uint64_t acc = 0;
+    unsigned fill = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        acc |= (uint64_t)src[i] << fill;
+        fill += bits;
+
+        while (fill >= 8)
+        {
+            *dst++ = acc;
+            acc >>= 8;
+            fill -= 8;
+        }
+    }
+
+    if (fill)
+        *dst = acc;
+}
+
+static auto unpack_scalar(const uint8_t *src, size_t count, uint16_t bits, uint16_t *dst) -> void
+{
+    const uint32_t mask = (1u << bits) - 1;
+    uint64_t acc = 0;
+    unsigned fill = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        while (fill < bits)
+        {
+            acc |= (uint64_t)*src++ << fill;
+            fill += 8;
+        }
+
+        dst[i] = acc & mask;
+        acc >>= bits;
+        fill -= bits;
+    }
+}
+
+BitPacker::BitPacker(uint16_t bits):
+    _bits(std::min<uint16_t>(bits, 16))
+{
+}
+
+auto BitPacker::set_frame_format(const VideoFrame::Format &format) -> void
+{
+    _frame_format = format;
+}
+
+auto BitPacker::set_crop(const VideoFrame::Rect &crop) -> void
+{
+    if (crop.x >= _frame_format.width || crop.y >= _frame_format.height)
+    {
+        _crop = {};
+        return;
+    }
+
+    _crop = crop;
+    _crop.width = std::min<uint16_t>(crop.width, _frame_format.width - crop.x);
+    _crop.height = std::min<uint16_t>(crop.height, _frame_format.height - crop.y);
+}
+
+auto BitPacker::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    if (frame->format.bits_per_pixel != 16 || frame->compression != VideoFrame::Compression::NONE)
+    {
+        if (!_warned)
+            warnx("bit packing needs uncompressed 16-bit frames, dropping");
+
+        _warned = true;
+
+        return nullptr;
+    }
+
+    const auto &format = frame->format;
+    const size_t row = (size_t)format.width * format.num_components;
+    const size_t count = std::min(row * format.height, frame->buffer.size() / sizeof(uint16_t));
+    const auto *px = (const uint16_t*)frame->buffer.data();
+
+    VideoFrame::Rect crop = _crop;
+    bool cropped = crop.width && crop.height && (crop.width < format.width || crop.height < format.height);
+
+    const uint16_t *src = px;
+    size_t src_count = count;
+
+    // Crops are small, gathering their rows is cheaper than packing strided
+    if (cropped)
+    {
+        size_t crop_row = (size_t)crop.width * format.num_components;
+        _tmp.resize(crop_row * crop.height);
+
+        for (size_t y = 0; y < crop.height; y++)
+        {
+            size_t offset = (crop.y + y) * row + crop.x * format.num_components;
+
+            if (offset + crop_row > count)
+                return nullptr;
+
+            memcpy(&_tmp[y * crop_row], px + offset, crop_row * sizeof(uint16_t));
+        }
+
+        src = _tmp.data();
+        src_count = _tmp.size();
+    }
+    else
+    {
+        crop = {0, 0, format.width, format.height};
+    }
+
+    uint16_t bits = _bits;
+
+    if (!bits)
+    {
+        using V = simd::u16;
+        constexpr size_t n = simd::lanes<V>;
+
+        V vmax{};
+        uint16_t max = 0;
+        size_t i = 0;
+
+        for (; i + n <= src_count; i += n)
+        {
+            vmax = simd::max(vmax, simd::load<V>(src + i));
+        }
+
+        for (size_t j = 0; j < n; j++)
+        {
+            max = std::max<uint16_t>(max, vmax[j]);
+        }
+
+        for (; i < src_count; i++)
+        {
+            max = std::max(max, src[i]);
+        }
+
+        bits = 2;
+
+        while (bits < 16 && (max >> bits))
+            bits += 2;
+    }
+    else if (bits < 16)
+    {
+        // Out of range samples would spill into their neighbours
+        if (!cropped)
+        {
+            _tmp.assign(src, src + src_count);
+            src = _tmp.data();
+        }
+
+        uint16_t max = (1u << bits) - 1;
+
+        for (auto &v : _tmp)
+        {
+            v = std::min(v, max);
+        }
+    }
+
+    auto ret = std::make_shared<VideoFrame>();
+    ret->format = format;
+    ret->format.width = crop.width;
+    ret->format.height = crop.height;
+    ret->format.bits_per_pixel = bits;
+    ret->compression = VideoFrame::Compression::PACKED;
+
+    size_t size = packed_size(src_count, bits);
+
+    // Room for the overlapping 8-byte stores past the end
+    ret->buffer.reserve(size + 8 + frame->metadata.telemetry_size);
+    ret->buffer.resize(size + 8);
+    pack(src, src_count, bits, ret->buffer.data());
+    ret->buffer.resize(size);
+
+    ret->inherit_metadata(*frame);
+    ret->origin_x = frame->origin_x + crop.x;
+    ret->origin_y = frame->origin_y + crop.y;
+
+    return ret;
+}
+
+auto BitPacker::packed_size(size_t count, uint16_t bits) -> size_t
+{
+    return (count * bits + 7) / 8;
+}
+
+// dst needs 8 bytes of slack past packed_size()
+auto BitPacker::pack(const uint16_t *src, size_t count, uint16_t bits, uint8_t *dst) -> void
+{
+    if (bits == 16)
+    {
+        memcpy(dst, src, count * sizeof(uint16_t));
+        return;
+    }
+
+    using V = simd::u16;
+    using W = simd::u32;
+    constexpr size_t n = simd::lanes<V>;
+    constexpr size_t groups = simd::lanes<u64>;
+
+    size_t i = 0;
+
+    if (bits % 2 == 0)
+    {
+        const size_t group_bytes = bits / 2;
+        const uint64_t pair_mask = ((uint64_t)1 << (2 * bits)) - 1;
+
+        for (; i + n <= count; i += n)
+        {
+            W v = (W)simd::load<V>(src + i);
+            W pairs = (v & 0xffff) | ((v >> 16) << bits);
+
+            u64 q = (u64)pairs;
+            q = (q & pair_mask) | ((q >> 32) << (2 * bits));
+
+            uint8_t *out = dst + (i / 4) * group_bytes;
+
+            for (size_t j = 0; j < groups; j++)
+            {
+                uint64_t lane = q[j];
+                memcpy(out + j * group_bytes, &lane, sizeof lane);
+            }
+        }
+    }
+
+    pack_scalar(src + i, count - i, bits, dst + i * bits / 8);
+}
+
+auto BitPacker::unpack(const uint8_t *src, size_t count, uint16_t bits, uint16_t *dst) -> void
+{
+    if (bits == 16)
+    {
+        memcpy(dst, src, count * sizeof(uint16_t));
+        return;
+    }
+
+    // Lanes have to be assembled from unaligned loads, with 32-byte vectors
+    // that costs more than the wider arithmetic saves
+    using V = uint16_t __attribute__((vector_size(16)));
+    using W = uint32_t __attribute__((vector_size(16)));
+    using Q = uint64_t __attribute__((vector_size(16)));
+    constexpr size_t n = simd::lanes<V>;
+    constexpr size_t groups = simd::lanes<Q>;
+
+    size_t i = 0;
+
+    if (bits % 2 == 0)
+    {
+        const size_t group_bytes = bits / 2;
+        const uint64_t pair_mask = ((uint64_t)1 << (2 * bits)) - 1;
+        const uint32_t mask = (1u << bits) - 1;
+
+        // The last 8-byte load of a vector reads past its groups, stop while
+        // that is still inside the input
+        const size_t src_size = packed_size(count, bits);
+
+        for (; i + n <= count && (i + n) / 4 * group_bytes + 8 <= src_size + group_bytes; i += n)
+        {
+            const uint8_t *in = src + (i / 4) * group_bytes;
+            uint64_t lanes[groups];
+
+            for (size_t j = 0; j < groups; j++)
+            {
+                memcpy(&lanes[j], in + j * group_bytes, sizeof lanes[j]);
+            }
+
+            Q q = simd::load<Q>(lanes);
+
+            W pairs = (W)((q & pair_mask) | (((q >> (2 * bits)) & pair_mask) << 32));
+            W v = (pairs & mask) | (((pairs >> bits) & mask) << 16);
+
+            simd::store(dst + i, (V)v);
+        }
+    }
+
+    unpack_scalar(src + i * bits / 8, count - i, bits, dst + i);
+}
+
+auto BitUnpacker::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    if (frame->compression != VideoFrame::Compression::PACKED)
+        return frame;
+
+    const uint16_t bits = frame->format.bits_per_pixel;
+    const size_t count = (size_t)frame->format.width * frame->format.height * frame->format.num_components;
+    const size_t packed_end = frame->metadata.telemetry_size ? frame->metadata.telemetry_offset : frame->buffer.size();
+
+    if (!bits || bits > 16 || BitPacker::packed_size(count, bits) > packed_end)
+        return nullptr;
+
+    auto ret = std::make_shared<VideoFrame>();
+    ret->format = frame->format;
+    ret->format.bits_per_pixel = 16;
+    ret->buffer.reserve(count * sizeof(uint16_t) + frame->metadata.telemetry_size);
+    ret->buffer.resize(count * sizeof(uint16_t));
+
+    BitPacker::unpack(frame->buffer.data(), count, bits, (uint16_t*)ret->buffer.data());
+
+    ret->inherit_metadata(*frame);
+    ret->origin_x = frame->origin_x;
+    ret->origin_y = frame->origin_y;
+
+    return ret;
+}
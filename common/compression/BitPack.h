@@ -0,0 +1,43 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "VideoFrame.h"
+#include <cstdint>
+#include <vector>
+
+// Raw mode for links where codec latency matters more than bandwidth. 16-bit
+// samples are packed to their effective bit depth as an LSB-first bit
+// stream, sample i taking bits [i * bits, (i + 1) * bits). Packed frames
+// have Compression::PACKED and bits_per_pixel set to the packed depth.
+// Other frames are dropped.
+class BitPacker : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    // bits 0 picks the depth per frame from the largest sample, rounded up
+    // to even. Samples above a fixed depth are clamped.
+    BitPacker(uint16_t bits = 0);
+
+    // Same as JpegLsEncoder::set_crop, the format is the full frame's
+    auto set_frame_format(const VideoFrame::Format &format) -> void;
+    auto set_crop(const VideoFrame::Rect &crop) -> void;
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+
+    static auto packed_size(size_t count, uint16_t bits) -> size_t;
+    static auto pack(const uint16_t *src, size_t count, uint16_t bits, uint8_t *dst) -> void;
+    static auto unpack(const uint8_t *src, size_t count, uint16_t bits, uint16_t *dst) -> void;
+
+private:
+    uint16_t _bits;
+    VideoFrame::Format _frame_format{};
+    VideoFrame::Rect _crop{};
+    std::vector<uint16_t> _tmp;
+    bool _warned{false};
+};
+
+// Turns PACKED frames back into 16-bit ones, other frames pass through
+class BitUnpacker : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+};
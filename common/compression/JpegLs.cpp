@@ -1,45 +1,152 @@
 #include "JpegLs.h"
+#include <algorithm>
 
 std::shared_ptr<VideoFrame> JpegLsEncoder::process_frame(const std::shared_ptr<VideoFrame> &frame)
 {
+    VideoFrame::Rect crop = _crop;
+
+    if (!crop.width || !crop.height)
+        crop = {0, 0, _frame_format.width, _frame_format.height};
+
+    if (crop.width != _encoded_format.width || crop.height != _encoded_format.height)
+        configure(crop.width, crop.height);
+
     _jpegls_encoder.rewind();
 
-    size_t out_size = _jpegls_encoder.encode(frame->buffer.data(), frame->buffer.size());
+    size_t out_size;
+
+    if (crop.width == _frame_format.width && crop.height == _frame_format.height)
+    {
+        out_size = _jpegls_encoder.encode(frame->buffer.data(), frame->buffer.size());
+    }
+    else
+    {
+        // The encoder walks the window with the full frame's stride, nothing
+        // is copied
+        size_t pixel_size = (size_t)_frame_format.num_components * ((_frame_format.bits_per_pixel + 7) / 8);
+        size_t stride = _frame_format.width * pixel_size;
+        size_t offset = crop.y * stride + crop.x * pixel_size;
+
+        if (offset >= frame->buffer.size())
+            return nullptr;
 
-    return std::make_shared<VideoFrame>(VideoFrame{
-        {_dest_buffer.data(), _dest_buffer.data() + out_size},
-        frame->format,
-        VideoFrame::Compression::JPEG_LS
-    });
+        out_size = _jpegls_encoder.encode(frame->buffer.data() + offset, frame->buffer.size() - offset, stride);
+    }
+
+    auto ret = acquire_frame(_pool);
+    ret->buffer.reserve(out_size + frame->metadata.telemetry_size);
+    ret->buffer.assign(_dest_buffer.data(), _dest_buffer.data() + out_size);
+    ret->format = _encoded_format;
+    ret->compression = VideoFrame::Compression::JPEG_LS;
+    ret->inherit_metadata(*frame);
+    ret->origin_x = frame->origin_x + crop.x;
+    ret->origin_y = frame->origin_y + crop.y;
+
+    return ret;
 }
 
 auto JpegLsEncoder::set_frame_format(const VideoFrame::Format &format) -> void
 {
     _frame_format = format;
 
+    configure(format.width, format.height);
+}
+
+auto JpegLsEncoder::set_crop(const VideoFrame::Rect &crop) -> void
+{
+    if (crop.x >= _frame_format.width || crop.y >= _frame_format.height)
+    {
+        _crop = {};
+        return;
+    }
+
+    _crop = crop;
+    _crop.width = std::min<uint16_t>(crop.width, _frame_format.width - crop.x);
+    _crop.height = std::min<uint16_t>(crop.height, _frame_format.height - crop.y);
+}
+
+auto JpegLsEncoder::set_near_lossless(int near) -> void
+{
+    _near = near;
+
+    // Picked up by the next frame
+    _encoded_format = {};
+}
+
+auto JpegLsEncoder::set_frame_pool(FramePool *pool) -> void
+{
+    _pool = pool;
+}
+
+// A fresh encoder is cheap, the destination buffer only ever grows so
+// switching between crop sizes doesn't reallocate
+auto JpegLsEncoder::configure(uint16_t width, uint16_t height) -> void
+{
+    _encoded_format = _frame_format;
+    _encoded_format.width = width;
+    _encoded_format.height = height;
+
     charls::frame_info frame_info;
-    frame_info.width = format.width;
-    frame_info.height = format.height;
-    frame_info.component_count = format.num_components;
-    frame_info.bits_per_sample = format.bits_per_pixel;
+    frame_info.width = width;
+    frame_info.height = height;
+    frame_info.component_count = _frame_format.num_components;
+    frame_info.bits_per_sample = _frame_format.bits_per_pixel;
 
+    _jpegls_encoder = charls::jpegls_encoder{};
     _jpegls_encoder.frame_info(frame_info);
+    _jpegls_encoder.near_lossless(_near);
+
+    if (size_t size = _jpegls_encoder.estimated_destination_size(); size > _dest_buffer.size())
+        _dest_buffer.resize(size);
 
-    _dest_buffer.resize(_jpegls_encoder.estimated_destination_size());
     _jpegls_encoder.destination(_dest_buffer);
 }
 
+static auto to_format(const charls::frame_info &frame_info) -> VideoFrame::Format
+{
+    VideoFrame::Format ret;
+    ret.width = frame_info.width;
+    ret.height = frame_info.height;
+    ret.num_components = frame_info.component_count;
+    ret.bits_per_pixel = frame_info.bits_per_sample;
+
+    return ret;
+}
+
 std::shared_ptr<VideoFrame> JpegLsDecoder::process_frame(const std::shared_ptr<VideoFrame> &frame)
 {
-    std::vector<uint8_t> out_buffer;
+    if (frame->compression != VideoFrame::Compression::JPEG_LS)
+        return frame;
 
-    const auto [frame_info, inverleave_mode] = _jpegls_decoder.decode(frame->buffer, out_buffer);
+    // Telemetry kept raw behind the codestream is not part of it
+    size_t codestream_size = frame->metadata.telemetry_size ? frame->metadata.telemetry_offset : frame->buffer.size();
 
-    _frame_format.width = frame_info.width;
-    _frame_format.height = frame_info.height;
-    _frame_format.num_components = frame_info.component_count;
-    _frame_format.bits_per_pixel = frame_info.bits_per_sample;
+    auto ret = decode(frame->buffer.data(), codestream_size, frame->metadata.telemetry_size);
+    ret->inherit_metadata(*frame);
+    ret->origin_x = frame->origin_x;
+    ret->origin_y = frame->origin_y;
 
-    return std::make_shared<VideoFrame>(VideoFrame{out_buffer, _frame_format});
+    return ret;
 }
 
+auto JpegLsDecoder::decode(const uint8_t *data, size_t size, size_t reserve, FramePool *pool) -> VideoFramePtr
+{
+    charls::jpegls_decoder decoder(data, size, true);
+
+    auto ret = acquire_frame(pool);
+    ret->buffer.reserve(decoder.destination_size() + reserve);
+    ret->buffer.resize(decoder.destination_size());
+    decoder.decode(ret->buffer);
+
+    _frame_format = to_format(decoder.frame_info());
+    ret->format = _frame_format;
+
+    return ret;
+}
+
+auto JpegLsDecoder::frame_format(const uint8_t *data, size_t size) -> VideoFrame::Format
+{
+    charls::jpegls_decoder decoder(data, size, true);
+
+    return to_format(decoder.frame_info());
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "FramePipeline.h"
+#include "FramePool.h"
 #include "VideoFrame.h"
 #include <cstdint>
 #include <memory>
@@ -14,19 +15,43 @@ public:
     auto process_frame(const std::shared_ptr<VideoFrame> &frame) -> std::shared_ptr<VideoFrame> override;
     auto set_frame_format(const VideoFrame::Format &format) -> void;
 
+    // Encodes only this window of the frames, read in place from the full
+    // frame. A zero width or height encodes the full frame again.
+    auto set_crop(const VideoFrame::Rect &crop) -> void;
+
+    // Largest error allowed per sample, 0 is lossless
+    auto set_near_lossless(int near) -> void;
+
+    // Encoded frames are taken from pool, nullptr allocates each one
+    auto set_frame_pool(FramePool *pool) -> void;
+
 private:
     charls::jpegls_encoder _jpegls_encoder;
-    VideoFrame::Format _frame_format;
+    int _near{0};
+    FramePool *_pool{nullptr};
+    VideoFrame::Format _frame_format{};
+    VideoFrame::Rect _crop{};
+    VideoFrame::Format _encoded_format{};
     std::vector<uint8_t> _dest_buffer;
+
+    auto configure(uint16_t width, uint16_t height) -> void;
 };
 
+// Frames that aren't JPEG-LS pass through
 class JpegLsDecoder : public FramePipeline<VideoFrame>::IComponent
 {
 public:
     auto process_frame(const std::shared_ptr<VideoFrame> &frame) -> std::shared_ptr<VideoFrame> override;
 
+    // Decodes a codestream that isn't held by a frame, e.g. mapped from a
+    // file, into a frame from pool if there is one. The buffer gets room for
+    // reserve more bytes.
+    auto decode(const uint8_t *data, size_t size, size_t reserve = 0, FramePool *pool = nullptr) -> VideoFramePtr;
+
+    // Format of the frame in a codestream, only the header is parsed
+    static auto frame_format(const uint8_t *data, size_t size) -> VideoFrame::Format;
+
 private:
-    charls::jpegls_decoder _jpegls_decoder;
     VideoFrame::Format _frame_format;
 };
 
@@ -0,0 +1,276 @@
+#include "processing/Clahe.h"
+#include "simd/Simd.h"
+#include <algorithm>
+
+Clahe::Clahe(const Config &config):
+    _config(config),
+    _pool(config.num_threads),
+    _width(0),
+    _height(0),
+    _min(0),
+    _bin_shift(8)
+{
+}
+
+auto Clahe::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    process_frame_in_place(*frame);
+
+    return frame;
+}
+
+auto Clahe::mutates_frame() const -> bool
+{
+    return true;
+}
+
+auto Clahe::process_frame_in_place(VideoFrame &frame) -> void
+{
+    size_t width = (size_t)frame.format.width * frame.format.num_components;
+    size_t height = frame.format.height > _config.ignored_rows ? frame.format.height - _config.ignored_rows : 0;
+
+    if (!width)
+        return;
+
+    height = std::min(height, frame.buffer.size() / sizeof(uint16_t) / width);
+
+    if (!height)
+        return;
+
+    auto *px = (uint16_t*)frame.buffer.data();
+
+    resize(width, height);
+    find_range(px);
+
+    _pool.parallel_for(_row_interp.back().t1 + 1, [&](size_t ty){
+        build_tile_row(px, ty);
+    });
+
+    size_t num_chunks = std::min(height, (_pool.num_threads() + 1) * 4);
+    size_t chunk_rows = (height + num_chunks - 1) / num_chunks;
+
+    _pool.parallel_for(num_chunks, [&](size_t chunk){
+        map_rows(px, chunk * chunk_rows, std::min(height, (chunk + 1) * chunk_rows));
+    });
+}
+
+// Tile sizes and the interpolation tables only change with the frame size
+auto Clahe::resize(size_t width, size_t height) -> void
+{
+    if (width == _width && height == _height)
+        return;
+
+    _width = width;
+    _height = height;
+
+    auto make_interp = [](size_t size, size_t num_tiles) {
+        num_tiles = std::clamp<size_t>(num_tiles, 1, size);
+
+        size_t tile_size = (size + num_tiles - 1) / num_tiles;
+        num_tiles = (size + tile_size - 1) / tile_size;
+
+        std::vector<Interp> ret(size);
+
+        for (size_t i = 0; i < size; i++)
+        {
+            // Position relative to the first tile center, in tiles
+            double pos = ((double)i - tile_size / 2.0) / tile_size;
+
+            if (pos <= 0)
+            {
+                ret[i] = {0, 0, 0};
+            }
+            else if (pos >= num_tiles - 1)
+            {
+                ret[i] = {(uint16_t)(num_tiles - 1), (uint16_t)(num_tiles - 1), 0};
+            }
+            else
+            {
+                auto t0 = (uint16_t)pos;
+                ret[i] = {t0, (uint16_t)(t0 + 1), (uint16_t)((pos - t0) * 256)};
+            }
+        }
+
+        return ret;
+    };
+
+    _col_interp = make_interp(width, _config.tiles_x);
+    _row_interp = make_interp(height, _config.tiles_y);
+
+    size_t num_tiles = (size_t)(_col_interp.back().t1 + 1) * (_row_interp.back().t1 + 1);
+
+    _tile_hist.resize(num_tiles * num_bins);
+    _tile_lut.resize(num_tiles * num_bins);
+}
+
+auto Clahe::find_range(const uint16_t *px) -> void
+{
+    using V = simd::u16;
+    constexpr size_t n = simd::lanes<V>;
+
+    size_t count = _width * _height;
+    V vmin = simd::splat<V>(0xffff), vmax = V{};
+    size_t i = 0;
+
+    for (; i + n <= count; i += n)
+    {
+        V v = simd::load<V>(px + i);
+        vmin = simd::min(vmin, v);
+        vmax = simd::max(vmax, v);
+    }
+
+    uint16_t lo = 0xffff, hi = 0;
+
+    for (size_t j = 0; j < n && count >= n; j++)
+    {
+        lo = std::min(lo, vmin[j]);
+        hi = std::max(hi, vmax[j]);
+    }
+
+    for (; i < count; i++)
+    {
+        lo = std::min(lo, px[i]);
+        hi = std::max(hi, px[i]);
+    }
+
+    _min = lo;
+    _bin_shift = 0;
+
+    while ((size_t)((hi - lo) >> _bin_shift) >= num_bins)
+        _bin_shift++;
+}
+
+// Walks the rows of one band of tiles once, counting into the histogram of
+// whichever tile each run of pixels falls into
+auto Clahe::build_tile_row(const uint16_t *px, size_t ty) -> void
+{
+    size_t tiles_x = _col_interp.back().t1 + 1;
+    size_t tiles_y = _row_interp.back().t1 + 1;
+    size_t tile_w = (_width + tiles_x - 1) / tiles_x;
+    size_t tile_h = (_height + tiles_y - 1) / tiles_y;
+
+    uint32_t *hist = &_tile_hist[ty * tiles_x * num_bins];
+    std::fill(hist, hist + tiles_x * num_bins, 0);
+
+    size_t y0 = ty * tile_h, y1 = std::min(_height, y0 + tile_h);
+
+    for (size_t y = y0; y < y1; y++)
+    {
+        const uint16_t *row = px + y * _width;
+
+        for (size_t tx = 0; tx < tiles_x; tx++)
+        {
+            uint32_t *tile_hist = hist + tx * num_bins;
+            size_t x1 = std::min(_width, (tx + 1) * tile_w);
+
+            for (size_t x = tx * tile_w; x < x1; x++)
+            {
+                tile_hist[(row[x] - _min) >> _bin_shift]++;
+            }
+        }
+    }
+
+    for (size_t tx = 0; tx < tiles_x; tx++)
+    {
+        size_t x0 = tx * tile_w, x1 = std::min(_width, x0 + tile_w);
+
+        build_tile_lut(ty * tiles_x + tx, (x1 - x0) * (y1 - y0));
+    }
+}
+
+auto Clahe::build_tile_lut(size_t tile, uint32_t num_pixels) -> void
+{
+    uint32_t *hist = &_tile_hist[tile * num_bins];
+    uint16_t *lut = &_tile_lut[tile * num_bins];
+
+    if (!num_pixels)
+    {
+        std::fill(lut, lut + num_bins, 0);
+        return;
+    }
+
+    // Bins above the clip limit are cut and the excess spread evenly over
+    // every bin, which limits how much the tile's contrast can be amplified
+    uint32_t clip = std::max<uint32_t>(1, _config.clip_limit * num_pixels / num_bins);
+    uint32_t excess = 0;
+
+    for (size_t b = 0; b < num_bins; b++)
+    {
+        if (hist[b] > clip)
+        {
+            excess += hist[b] - clip;
+            hist[b] = clip;
+        }
+    }
+
+    uint32_t spread = excess / num_bins, remainder = excess % num_bins;
+    uint64_t cdf = 0;
+
+    for (size_t b = 0; b < num_bins; b++)
+    {
+        cdf += hist[b] + spread + (b < remainder);
+        lut[b] = cdf * 65535 / num_pixels;
+    }
+}
+
+auto Clahe::map_rows(uint16_t *px, size_t y0, size_t y1) -> void
+{
+    using W = simd::u32;
+    constexpr size_t n = simd::lanes<W>;
+
+    size_t tiles_x = _col_interp.back().t1 + 1;
+
+    // Lookups go through scratch rows, the blending runs on whole vectors
+    thread_local std::vector<uint32_t> a, b, c, d, wx;
+
+    size_t padded = (_width + n - 1) / n * n;
+
+    for (auto *buf : {&a, &b, &c, &d, &wx})
+    {
+        buf->assign(padded, 0);
+    }
+
+    for (size_t x = 0; x < _width; x++)
+    {
+        wx[x] = _col_interp[x].w1;
+    }
+
+    const W full = simd::splat<W>(256);
+
+    for (size_t y = y0; y < y1; y++)
+    {
+        uint16_t *row = px + y * _width;
+        const auto &ri = _row_interp[y];
+
+        const uint16_t *top = &_tile_lut[ri.t0 * tiles_x * num_bins];
+        const uint16_t *bot = &_tile_lut[ri.t1 * tiles_x * num_bins];
+
+        for (size_t x = 0; x < _width; x++)
+        {
+            const auto &ci = _col_interp[x];
+            size_t bin = (row[x] - _min) >> _bin_shift;
+            size_t l = ci.t0 * num_bins + bin, r = ci.t1 * num_bins + bin;
+
+            a[x] = top[l];
+            b[x] = top[r];
+            c[x] = bot[l];
+            d[x] = bot[r];
+        }
+
+        const W wy = simd::splat<W>(ri.w1);
+
+        for (size_t x = 0; x < padded; x += n)
+        {
+            W w = simd::load<W>(&wx[x]);
+            W t = (simd::load<W>(&a[x]) * (full - w) + simd::load<W>(&b[x]) * w) >> 8;
+            W u = (simd::load<W>(&c[x]) * (full - w) + simd::load<W>(&d[x]) * w) >> 8;
+
+            simd::store(&a[x], (t * (full - wy) + u * wy) >> 8);
+        }
+
+        for (size_t x = 0; x < _width; x++)
+        {
+            row[x] = a[x];
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "ThreadPool.h"
+#include "VideoFrame.h"
+#include <cstdint>
+#include <vector>
+
+// Contrast limited adaptive histogram equalization for 16-bit single channel
+// frames. Every tile gets its own clipped histogram and mapping, pixels are
+// mapped by bilinear interpolation between the four nearest tile mappings.
+// Histograms and interpolation are split across a thread pool.
+class Clahe : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    struct Config
+    {
+        uint16_t tiles_x{8};
+        uint16_t tiles_y{8};
+        float clip_limit{3.0f}; // in multiples of the mean bin count
+        uint16_t ignored_rows{0};
+        size_t num_threads{0};  // 0 uses every core
+    };
+
+    Clahe(const Config &config);
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+    auto process_frame_in_place(VideoFrame &frame) -> void;
+    auto mutates_frame() const -> bool override;
+
+private:
+    static constexpr size_t num_bins = 256;
+
+    Config _config;
+    ThreadPool _pool;
+
+    size_t _width;
+    size_t _height;
+    uint16_t _min;
+    unsigned _bin_shift;
+
+    // Per tile histogram, reused as the tile's mapping table
+    std::vector<uint32_t> _tile_hist;
+    std::vector<uint16_t> _tile_lut;
+
+    // Per column: left tile index, right tile index and weight of the right one
+    struct Interp
+    {
+        uint16_t t0;
+        uint16_t t1;
+        uint16_t w1;
+    };
+
+    std::vector<Interp> _col_interp;
+    std::vector<Interp> _row_interp;
+
+    auto resize(size_t width, size_t height) -> void;
+    auto find_range(const uint16_t *px) -> void;
+    auto build_tile_row(const uint16_t *px, size_t ty) -> void;
+    auto build_tile_lut(size_t tile, uint32_t num_pixels) -> void;
+    auto map_rows(uint16_t *px, size_t y0, size_t y1) -> void;
+};
@@ -0,0 +1,105 @@
+#include "processing/Downscaler.h"
+#include "simd/Simd.h"
+#include <algorithm>
+#include <err.h>
+
+Downscaler::Downscaler(unsigned factor, uint16_t ignored_rows):
+    _factor(factor),
+    _ignored_rows(ignored_rows)
+{
+    if (factor != 2 && factor != 4)
+        errx(1, "unsupported downscale factor %u", factor);
+}
+
+auto Downscaler::output_format(const VideoFrame::Format &format) const -> VideoFrame::Format
+{
+    VideoFrame::Format ret = format;
+    uint16_t height = format.height > _ignored_rows ? format.height - _ignored_rows : 0;
+
+    ret.width = format.width / _factor;
+    ret.height = height / _factor;
+
+    return ret;
+}
+
+auto Downscaler::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    if (frame->format.bits_per_pixel != 16 || frame->format.num_components != 1
+            || frame->compression != VideoFrame::Compression::NONE)
+    {
+        if (!_warned)
+            warnx("downscale needs uncompressed 16-bit single channel frames, dropping");
+
+        _warned = true;
+
+        return nullptr;
+    }
+
+    size_t width = frame->format.width;
+    size_t height = frame->format.height > _ignored_rows ? frame->format.height - _ignored_rows : 0;
+
+    if (!width)
+        return frame;
+
+    height = std::min(height, frame->buffer.size() / sizeof(uint16_t) / width);
+
+    auto ret = std::make_shared<VideoFrame>();
+    ret->format = output_format(frame->format);
+    ret->format.height = height / _factor;
+    ret->buffer.reserve((size_t)ret->format.width * ret->format.height * sizeof(uint16_t) + frame->metadata.telemetry_size);
+    ret->buffer.resize((size_t)ret->format.width * ret->format.height * sizeof(uint16_t));
+
+    const auto *src = (const uint16_t*)frame->buffer.data();
+    auto *dst = (uint16_t*)ret->buffer.data();
+
+    if (_factor == 2)
+    {
+        downscale_2x(src, width, height, dst);
+    }
+    else
+    {
+        _tmp.resize((width / 2) * (height / 2));
+        downscale_2x(src, width, height, _tmp.data());
+        downscale_2x(_tmp.data(), width / 2, height / 2, dst);
+    }
+
+    ret->inherit_metadata(*frame);
+    ret->metadata.has_stats = false;
+
+    return ret;
+}
+
+auto Downscaler::downscale_2x(const uint16_t *src, size_t width, size_t height, uint16_t *dst) -> void
+{
+    using V = simd::u16;
+    using W = simd::u32;
+    using H = uint16_t __attribute__((vector_size(simd::width / 2)));
+    constexpr size_t n = simd::lanes<V>;
+
+    const size_t out_width = width / 2;
+    const W round = simd::splat<W>(2);
+
+    for (size_t y = 0; y + 1 < height; y += 2)
+    {
+        const uint16_t *r0 = src + y * width;
+        const uint16_t *r1 = r0 + width;
+        uint16_t *out = dst + (y / 2) * out_width;
+        size_t x = 0;
+
+        // Viewed as 32-bit lanes a vector holds horizontal pairs, the low
+        // half is the left pixel and the high half the right one
+        for (; x + n <= out_width * 2; x += n)
+        {
+            W a = (W)simd::load<V>(r0 + x);
+            W b = (W)simd::load<V>(r1 + x);
+            W sum = (a & 0xffff) + (a >> 16) + (b & 0xffff) + (b >> 16);
+
+            simd::store(out + x / 2, __builtin_convertvector((sum + round) >> 2, H));
+        }
+
+        for (; x + 1 < width; x += 2)
+        {
+            out[x / 2] = ((uint32_t)r0[x] + r0[x + 1] + r1[x] + r1[x + 1] + 2) >> 2;
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "VideoFrame.h"
+#include <cstdint>
+#include <vector>
+
+// Box filter downscale of 16-bit single channel frames by 2 or 4. Rows at
+// the bottom of the frame (sensor telemetry) are left out of the output.
+// Chaining 2x components gives a resolution pyramid, each level computed
+// from the previous one. Other frames are dropped.
+class Downscaler : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    Downscaler(unsigned factor = 2, uint16_t ignored_rows = 0);
+
+    auto output_format(const VideoFrame::Format &format) const -> VideoFrame::Format;
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+
+    // Halves both dimensions, odd trailing rows and columns are dropped
+    static auto downscale_2x(const uint16_t *src, size_t width, size_t height, uint16_t *dst) -> void;
+
+private:
+    unsigned _factor;
+    uint16_t _ignored_rows;
+    std::vector<uint16_t> _tmp;
+    bool _warned{false};
+};
@@ -0,0 +1,218 @@
+#include "processing/HistogramEqualizer.h"
+#include "simd/Simd.h"
+#include <algorithm>
+
+HistogramEqualizer::HistogramEqualizer(uint16_t ignored_rows, Mode mode):
+    _ignored_rows(ignored_rows),
+    _mode(mode),
+    _lo_thresh(1000),
+    _hi_thresh(200),
+    _row_step(1),
+    _hist{},
+    _lo_bin(0),
+    _hi_bin(255)
+{
+}
+
+auto HistogramEqualizer::set_thresholds(uint32_t lo_thresh, uint32_t hi_thresh) -> void
+{
+    _lo_thresh = lo_thresh;
+    _hi_thresh = hi_thresh;
+}
+
+auto HistogramEqualizer::set_row_step(uint16_t step) -> void
+{
+    _row_step = std::max<uint16_t>(step, 1);
+}
+
+auto HistogramEqualizer::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    process_frame_in_place(*frame);
+
+    return frame;
+}
+
+auto HistogramEqualizer::process_frame_in_place(VideoFrame &frame) -> void
+{
+    size_t width = (size_t)frame.format.width * frame.format.num_components;
+    size_t height = frame.format.height > _ignored_rows ? frame.format.height - _ignored_rows : 0;
+
+    if (!width)
+        return;
+
+    height = std::min(height, frame.buffer.size() / sizeof(uint16_t) / width);
+
+    auto *px = (uint16_t*)frame.buffer.data();
+
+    if (!build_histogram(px, width, height))
+        return;
+
+    int lo_bin{-1}, hi_bin{-1};
+
+    for (size_t i = 0; i < _hist.size(); i++)
+    {
+        uint32_t count = _hist[i] * _row_step;
+
+        if (lo_bin == -1 && count > _lo_thresh)
+        {
+            lo_bin = i;
+            hi_bin = i;
+        }
+        else if (lo_bin != -1 && count > _hi_thresh)
+        {
+            hi_bin = i;
+        }
+    }
+
+    if (lo_bin == -1)
+    {
+        lo_bin = 0;
+        hi_bin = _hist.size() - 1;
+    }
+
+    _lo_bin = lo_bin;
+    _hi_bin = hi_bin;
+
+    if (_mode == Mode::STRETCH)
+    {
+        stretch(px, width * height);
+    }
+    else
+    {
+        build_lut();
+        remap(px, width * height);
+    }
+}
+
+auto HistogramEqualizer::mutates_frame() const -> bool
+{
+    return true;
+}
+
+auto HistogramEqualizer::range() const -> std::pair<uint16_t, uint16_t>
+{
+    return {(uint16_t)(_lo_bin * 256), (uint16_t)((_hi_bin + 1) * 256 - 1)};
+}
+
+auto HistogramEqualizer::build_histogram(const uint16_t *px, size_t width, size_t height) -> uint32_t
+{
+    // Consecutive samples count into separate tables so increments of equal
+    // bins don't serialize on the same memory location
+    std::array<std::array<uint32_t, 256>, 4> sub_hist{};
+    uint32_t sampled = 0;
+
+    for (size_t y = 0; y < height; y += _row_step)
+    {
+        const uint16_t *row = px + y * width;
+        size_t x = 0;
+
+        for (; x + 4 <= width; x += 4)
+        {
+            sub_hist[0][row[x] >> 8]++;
+            sub_hist[1][row[x + 1] >> 8]++;
+            sub_hist[2][row[x + 2] >> 8]++;
+            sub_hist[3][row[x + 3] >> 8]++;
+        }
+
+        for (; x < width; x++)
+        {
+            sub_hist[0][row[x] >> 8]++;
+        }
+
+        sampled += width;
+    }
+
+    for (size_t i = 0; i < _hist.size(); i++)
+    {
+        _hist[i] = sub_hist[0][i] + sub_hist[1][i] + sub_hist[2][i] + sub_hist[3][i];
+    }
+
+    return sampled;
+}
+
+auto HistogramEqualizer::build_lut() -> void
+{
+    _lut.resize((_hi_bin - _lo_bin + 1) * 256);
+
+    uint64_t total = 0;
+
+    for (int b = _lo_bin; b <= _hi_bin; b++)
+    {
+        total += _hist[b];
+    }
+
+    // Cumulative count in 1/256 pixel units, interpolated inside each bin
+    double scale = 65535.0 / std::max<uint64_t>(total * 256, 1);
+    uint64_t cdf = 0;
+
+    for (int b = _lo_bin; b <= _hi_bin; b++)
+    {
+        uint16_t *out = &_lut[(b - _lo_bin) * 256];
+
+        for (uint32_t j = 0; j < 256; j++)
+        {
+            out[j] = std::min(65535.0, (cdf + (uint64_t)_hist[b] * (j + 1)) * scale);
+        }
+
+        cdf += (uint64_t)_hist[b] * 256;
+    }
+}
+
+auto HistogramEqualizer::stretch(uint16_t *px, size_t count) const -> void
+{
+    using V = simd::u16;
+    using W = simd::u32;
+    constexpr size_t n = simd::lanes<V>;
+
+    const auto [vmin, vmax] = range();
+    const uint32_t scale = (65535u << 16) / (vmax - vmin);
+
+    const V lo = simd::splat<V>(vmin), hi = simd::splat<V>(vmax);
+    const W vscale = simd::splat<W>(scale), mask = simd::splat<W>(0xffff);
+
+    size_t i = 0;
+
+    // (v - vmin) * scale never exceeds 32 bits since v - vmin <= vmax - vmin.
+    // Even and odd 16-bit lanes are widened in place by viewing the vector as
+    // 32-bit lanes.
+    for (; i + n <= count; i += n)
+    {
+        W v = (W)(simd::clamp(simd::load<V>(px + i), lo, hi) - lo);
+        W even = ((v & mask) * vscale) >> 16;
+        W odd = ((v >> 16) * vscale) >> 16;
+
+        simd::store(px + i, (V)(even | (odd << 16)));
+    }
+
+    for (; i < count; i++)
+    {
+        px[i] = ((uint32_t)(std::clamp(px[i], vmin, vmax) - vmin) * scale) >> 16;
+    }
+}
+
+auto HistogramEqualizer::remap(uint16_t *px, size_t count) const -> void
+{
+    using V = simd::u16;
+    constexpr size_t n = simd::lanes<V>;
+
+    const auto [vmin, vmax] = range();
+    const V lo = simd::splat<V>(vmin), hi = simd::splat<V>(vmax);
+    const uint16_t *lut = _lut.data();
+
+    size_t i = 0;
+
+    for (; i + n <= count; i += n)
+    {
+        V idx = simd::clamp(simd::load<V>(px + i), lo, hi) - lo;
+
+        for (size_t j = 0; j < n; j++)
+        {
+            px[i + j] = lut[idx[j]];
+        }
+    }
+
+    for (; i < count; i++)
+    {
+        px[i] = lut[std::clamp(px[i], vmin, vmax) - vmin];
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "VideoFrame.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Contrast stretch / histogram equalization for 16-bit single channel frames.
+// A coarse 256-bin histogram (top 8 bits) picks the range of interest [lo, hi]
+// and values outside of it are clamped. Rows at the bottom of the frame
+// (sensor telemetry) can be excluded and are left untouched.
+class HistogramEqualizer : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    enum class Mode
+    {
+        STRETCH,  // linear map of [lo, hi] onto the full 16-bit range, done
+                  // with a vectorized fixed-point multiply
+        EQUALIZE, // map through a lookup table built from the cumulative
+                  // histogram of [lo, hi]
+    };
+
+    HistogramEqualizer(uint16_t ignored_rows = 0, Mode mode = Mode::STRETCH);
+
+    // Bins with more than lo_thresh pixels start the range, bins with more
+    // than hi_thresh pixels extend it. Counts are in full-frame pixels.
+    auto set_thresholds(uint32_t lo_thresh, uint32_t hi_thresh) -> void;
+
+    // Build the histogram from every n-th row only, enough for threshold
+    // estimation on large frames
+    auto set_row_step(uint16_t step) -> void;
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+    auto process_frame_in_place(VideoFrame &frame) -> void;
+    auto mutates_frame() const -> bool override;
+
+    // Range picked for the last frame
+    auto range() const -> std::pair<uint16_t, uint16_t>;
+
+private:
+    uint16_t _ignored_rows;
+    Mode _mode;
+    uint32_t _lo_thresh;
+    uint32_t _hi_thresh;
+    uint16_t _row_step;
+
+    std::array<uint32_t, 256> _hist;
+    int _lo_bin;
+    int _hi_bin;
+    std::vector<uint16_t> _lut;
+
+    auto build_histogram(const uint16_t *px, size_t width, size_t height) -> uint32_t;
+    auto build_lut() -> void;
+    auto stretch(uint16_t *px, size_t count) const -> void;
+    auto remap(uint16_t *px, size_t count) const -> void;
+};
@@ -0,0 +1,309 @@
+#include "processing/NonUniformityCorrection.h"
+#include "simd/Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+NonUniformityCorrection::NonUniformityCorrection(uint16_t ignored_rows):
+    _ignored_rows(ignored_rows),
+    _width(0),
+    _height(0),
+    _capture_requested(false),
+    _requested_frames(0),
+    _requested_ref(Reference::LOW),
+    _requested_skip(0),
+    _capture_skip(0),
+    _capture_remaining(0),
+    _capture_count(0),
+    _capture_ref(Reference::LOW),
+    _level(0),
+    _calibrated(false)
+{
+}
+
+auto NonUniformityCorrection::capture_reference(size_t num_frames, Reference ref, size_t skip_frames) -> void
+{
+    std::lock_guard<std::mutex> lock(_request_mtx);
+
+    _requested_frames = num_frames;
+    _requested_ref = ref;
+    _requested_skip = skip_frames;
+    _capture_requested = true;
+}
+
+auto NonUniformityCorrection::add_bad_pixel(uint16_t x, uint16_t y) -> void
+{
+    _manual_bad_pixels.push_back({x, y});
+
+    update_replacements();
+}
+
+auto NonUniformityCorrection::load_bad_pixels(const std::string &path) -> bool
+{
+    std::ifstream fp(path);
+
+    if (!fp)
+        return false;
+
+    for (uint16_t x, y; fp >> x >> y;)
+    {
+        _manual_bad_pixels.push_back({x, y});
+    }
+
+    update_replacements();
+
+    return true;
+}
+
+auto NonUniformityCorrection::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    size_t width = (size_t)frame->format.width * frame->format.num_components;
+    size_t height = frame->format.height > _ignored_rows ? frame->format.height - _ignored_rows : 0;
+
+    if (!width)
+        return frame;
+
+    height = std::min(height, frame->buffer.size() / sizeof(uint16_t) / width);
+
+    if (width != _width || height != _height)
+        reset(width, height);
+
+    if (_capture_requested.exchange(false))
+    {
+        std::lock_guard<std::mutex> lock(_request_mtx);
+
+        _capture_skip = _requested_skip;
+        _capture_remaining = _requested_frames;
+        _capture_ref = _requested_ref;
+        _capture_count = 0;
+        _accum.assign(_width * _height, 0);
+    }
+
+    auto *px = (uint16_t*)frame->buffer.data();
+
+    if (_capture_skip && _capture_remaining)
+    {
+        _capture_skip--;
+        return nullptr;
+    }
+
+    if (_capture_remaining)
+    {
+        accumulate(px);
+
+        if (--_capture_remaining == 0)
+            finish_reference();
+
+        return nullptr;
+    }
+
+    if (_calibrated)
+        correct(px);
+
+    replace_bad_pixels(px);
+
+    return frame;
+}
+
+auto NonUniformityCorrection::mutates_frame() const -> bool
+{
+    return true;
+}
+
+auto NonUniformityCorrection::reset(size_t width, size_t height) -> void
+{
+    _width = width;
+    _height = height;
+
+    _capture_skip = 0;
+    _capture_remaining = 0;
+    _low.clear();
+    _high.clear();
+    _detected_bad_pixels.clear();
+    _calibrated = false;
+
+    update_replacements();
+}
+
+auto NonUniformityCorrection::accumulate(const uint16_t *px) -> void
+{
+    for (size_t i = 0; i < _accum.size(); i++)
+    {
+        _accum[i] += px[i];
+    }
+
+    ++_capture_count;
+}
+
+auto NonUniformityCorrection::finish_reference() -> void
+{
+    auto &ref = _capture_ref == Reference::LOW ? _low : _high;
+    ref.resize(_accum.size());
+
+    for (size_t i = 0; i < _accum.size(); i++)
+    {
+        ref[i] = (_accum[i] + _capture_count / 2) / _capture_count;
+    }
+
+    _accum.clear();
+    _accum.shrink_to_fit();
+
+    if (!_low.empty())
+        update_maps();
+}
+
+auto NonUniformityCorrection::update_maps() -> void
+{
+    size_t n = _low.size();
+
+    double sum = 0, sum_sq = 0;
+
+    for (auto v : _low)
+    {
+        sum += v;
+        sum_sq += (double)v * v;
+    }
+
+    double mean = sum / n;
+    double stddev = std::sqrt(std::max(0.0, sum_sq / n - mean * mean));
+
+    // Pixels far off the flat field are stuck rather than just offset
+    double max_dev = std::max(6 * stddev, 64.0);
+
+    _offset = _low;
+    _gain.assign(n, gain_one);
+    _level = std::lround(mean);
+    _detected_bad_pixels.clear();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (std::abs(_low[i] - mean) > max_dev)
+            _detected_bad_pixels.push_back(i);
+    }
+
+    if (_high.size() == n)
+    {
+        double mean_high = 0;
+
+        for (auto v : _high)
+        {
+            mean_high += v;
+        }
+
+        mean_high /= n;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            double response = (double)_high[i] - _low[i];
+            double gain = response > 0 ? (mean_high - mean) / response * gain_one : 0;
+
+            if (gain < gain_min || gain > gain_max)
+            {
+                _detected_bad_pixels.push_back(i);
+                gain = std::clamp<double>(gain, gain_min, gain_max);
+            }
+
+            _gain[i] = std::lround(gain);
+        }
+    }
+
+    _calibrated = true;
+
+    update_replacements();
+}
+
+auto NonUniformityCorrection::update_replacements() -> void
+{
+    std::vector<uint32_t> bad = _detected_bad_pixels;
+
+    for (const auto &[x, y] : _manual_bad_pixels)
+    {
+        if (x < _width && y < _height)
+            bad.push_back(y * _width + x);
+    }
+
+    std::sort(bad.begin(), bad.end());
+    bad.erase(std::unique(bad.begin(), bad.end()), bad.end());
+
+    auto is_bad = [&](uint32_t idx){ return std::binary_search(bad.begin(), bad.end(), idx); };
+
+    _replacements.clear();
+
+    for (auto idx : bad)
+    {
+        Replacement r{idx, {}, 0};
+        size_t x = idx % _width, y = idx / _width;
+
+        if (x > 0 && !is_bad(idx - 1))
+            r.neighbours[r.num_neighbours++] = idx - 1;
+        if (x + 1 < _width && !is_bad(idx + 1))
+            r.neighbours[r.num_neighbours++] = idx + 1;
+        if (y > 0 && !is_bad(idx - _width))
+            r.neighbours[r.num_neighbours++] = idx - _width;
+        if (y + 1 < _height && !is_bad(idx + _width))
+            r.neighbours[r.num_neighbours++] = idx + _width;
+
+        _replacements.push_back(r);
+    }
+}
+
+auto NonUniformityCorrection::correct(uint16_t *px) const -> void
+{
+    using V = simd::u16;
+    using W = simd::u32;
+    using I = simd::i32;
+    constexpr size_t n = simd::lanes<V>;
+
+    const size_t count = _width * _height;
+    const uint16_t *offset = _offset.data();
+    const uint16_t *gain = _gain.data();
+
+    const W mask = simd::splat<W>(0xffff);
+    const I level = simd::splat<I>(_level);
+    const I lo = I{}, hi = simd::splat<I>(0xffff);
+
+    // Even and odd 16-bit lanes are widened to 32 bits by reinterpreting
+    // the vector, then packed back the same way
+    auto apply = [&](W v, W o, W g) -> W {
+        I d = (I)v - (I)o;
+        return (W)simd::clamp(((d * (I)g) >> gain_shift) + level, lo, hi);
+    };
+
+    size_t i = 0;
+
+    for (; i + n <= count; i += n)
+    {
+        W v = (W)simd::load<V>(px + i);
+        W o = (W)simd::load<V>(offset + i);
+        W g = (W)simd::load<V>(gain + i);
+
+        W even = apply(v & mask, o & mask, g & mask);
+        W odd = apply(v >> 16, o >> 16, g >> 16);
+
+        simd::store(px + i, (V)(even | (odd << 16)));
+    }
+
+    for (; i < count; i++)
+    {
+        int32_t d = (int32_t)px[i] - offset[i];
+        px[i] = std::clamp(((d * gain[i]) >> gain_shift) + _level, 0, 0xffff);
+    }
+}
+
+auto NonUniformityCorrection::replace_bad_pixels(uint16_t *px) const -> void
+{
+    for (const auto &r : _replacements)
+    {
+        if (!r.num_neighbours)
+            continue;
+
+        uint32_t sum = 0;
+
+        for (uint32_t i = 0; i < r.num_neighbours; i++)
+        {
+            sum += px[r.neighbours[i]];
+        }
+
+        px[r.idx] = sum / r.num_neighbours;
+    }
+}
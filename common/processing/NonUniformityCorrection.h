@@ -0,0 +1,96 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "VideoFrame.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Flat-field non-uniformity correction for 16-bit single channel sensors.
+// Frames taken with the shutter closed are averaged into a per-pixel
+// reference. With only a LOW reference the correction removes the fixed
+// offset pattern, a second HIGH reference taken against a warmer flat field
+// adds per-pixel gain:
+//
+//     out = (v - low[i]) * gain[i] + mean(low)
+//
+// Dead pixels (from a list or detected while calibrating) are replaced by
+// the mean of their good 4-neighbours.
+class NonUniformityCorrection : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    enum class Reference
+    {
+        LOW,
+        HIGH,
+    };
+
+    NonUniformityCorrection(uint16_t ignored_rows = 0);
+
+    // Averages num_frames frames into the given reference, after skipping
+    // skip_frames, e.g. ones still in flight when the shutter was triggered.
+    // All of them are dropped from the pipeline. Can be called from any
+    // thread.
+    auto capture_reference(size_t num_frames, Reference ref = Reference::LOW, size_t skip_frames = 0) -> void;
+
+    // Known dead pixels, set before streaming starts
+    auto add_bad_pixel(uint16_t x, uint16_t y) -> void;
+
+    // One "x y" pair per line
+    auto load_bad_pixels(const std::string &path) -> bool;
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+    auto mutates_frame() const -> bool override;
+
+private:
+    // Gain is Q2.14, limited to [0.25, 2.0) so the products fit 32 bits
+    static constexpr unsigned gain_shift = 14;
+    static constexpr uint16_t gain_one = 1 << gain_shift;
+    static constexpr uint16_t gain_min = gain_one / 4;
+    static constexpr uint16_t gain_max = gain_one * 2 - 1;
+
+    uint16_t _ignored_rows;
+    size_t _width;
+    size_t _height;
+
+    std::mutex _request_mtx;
+    std::atomic<bool> _capture_requested;
+    size_t _requested_frames;
+    Reference _requested_ref;
+    size_t _requested_skip;
+
+    size_t _capture_skip;
+    size_t _capture_remaining;
+    size_t _capture_count;
+    Reference _capture_ref;
+    std::vector<uint32_t> _accum;
+
+    std::vector<uint16_t> _low;
+    std::vector<uint16_t> _high;
+    std::vector<uint16_t> _offset;
+    std::vector<uint16_t> _gain;
+    uint16_t _level;
+    bool _calibrated;
+
+    std::vector<std::pair<uint16_t, uint16_t>> _manual_bad_pixels;
+    std::vector<uint32_t> _detected_bad_pixels;
+
+    struct Replacement
+    {
+        uint32_t idx;
+        uint32_t neighbours[4];
+        uint32_t num_neighbours;
+    };
+
+    std::vector<Replacement> _replacements;
+
+    auto reset(size_t width, size_t height) -> void;
+    auto accumulate(const uint16_t *px) -> void;
+    auto finish_reference() -> void;
+    auto update_maps() -> void;
+    auto update_replacements() -> void;
+    auto correct(uint16_t *px) const -> void;
+    auto replace_bad_pixels(uint16_t *px) const -> void;
+};
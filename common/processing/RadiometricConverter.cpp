@@ -0,0 +1,262 @@
+#include "processing/RadiometricConverter.h"
+#include "simd/Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <type_traits>
+
+// Table lookups are scalar (there is no 16-bit gather and the 32-bit ones
+// are not faster than plain loads), min/max/sum of the results are kept in
+// vectors. Sums are flushed to double every chunk so 32-bit lanes can't
+// overflow.
+template<typename V, typename T>
+static auto convert(const uint16_t *in, T *out, size_t count, const T *lut, T &min, T &max) -> double
+{
+    constexpr size_t n = simd::lanes<V>;
+    constexpr size_t chunk = 4096;
+    constexpr bool is_float = std::is_floating_point_v<T>;
+
+    using Acc = std::conditional_t<is_float, simd::f32, simd::u32>;
+
+    V vmin = simd::splat<V>(std::numeric_limits<T>::max());
+    V vmax = simd::splat<V>(std::numeric_limits<T>::lowest());
+    double sum = 0;
+    size_t i = 0;
+
+    while (i + n <= count)
+    {
+        size_t end = std::min(count, i + chunk);
+        Acc acc{};
+
+        for (; i + n <= end; i += n)
+        {
+            for (size_t j = 0; j < n; j++)
+            {
+                out[i + j] = lut[in[i + j]];
+            }
+
+            V v = simd::load<V>(out + i);
+            vmin = simd::min(vmin, v);
+            vmax = simd::max(vmax, v);
+
+            if constexpr (is_float)
+                acc += v;
+            else
+                acc += ((Acc)v & 0xffff) + ((Acc)v >> 16);
+        }
+
+        for (size_t j = 0; j < simd::lanes<Acc>; j++)
+        {
+            sum += acc[j];
+        }
+    }
+
+    min = vmin[0];
+    max = vmax[0];
+
+    for (size_t j = 1; j < n; j++)
+    {
+        min = std::min<T>(min, vmin[j]);
+        max = std::max<T>(max, vmax[j]);
+    }
+
+    for (; i < count; i++)
+    {
+        out[i] = lut[in[i]];
+        min = std::min(min, out[i]);
+        max = std::max(max, out[i]);
+        sum += out[i];
+    }
+
+    return sum;
+}
+
+RadiometricConverter::RadiometricConverter(Output output, uint16_t ignored_rows):
+    _output(output),
+    _ignored_rows(ignored_rows),
+    _resolution(0.01),
+    _stats{}
+{
+    set_polynomial({0, 0.01});
+}
+
+auto RadiometricConverter::set_polynomial(const std::vector<double> &coeffs) -> void
+{
+    _kelvin.resize(65536);
+
+    for (size_t v = 0; v < _kelvin.size(); v++)
+    {
+        double k = 0;
+
+        for (auto it = coeffs.rbegin(); it != coeffs.rend(); ++it)
+        {
+            k = k * v + *it;
+        }
+
+        _kelvin[v] = k;
+    }
+
+    build_luts();
+}
+
+auto RadiometricConverter::set_table(std::vector<std::pair<uint16_t, double>> points) -> void
+{
+    if (points.empty())
+        return;
+
+    std::sort(points.begin(), points.end());
+
+    _kelvin.resize(65536);
+
+    size_t p = 0;
+
+    for (size_t v = 0; v < _kelvin.size(); v++)
+    {
+        while (p + 1 < points.size() && points[p + 1].first <= v)
+            p++;
+
+        const auto &[c0, k0] = points[p];
+
+        if (v <= c0 || p + 1 == points.size())
+        {
+            _kelvin[v] = k0;
+            continue;
+        }
+
+        const auto &[c1, k1] = points[p + 1];
+        _kelvin[v] = k0 + (k1 - k0) * (v - c0) / (c1 - c0);
+    }
+
+    build_luts();
+}
+
+auto RadiometricConverter::load_table(const std::string &path) -> bool
+{
+    std::ifstream fp(path);
+
+    if (!fp)
+        return false;
+
+    std::vector<std::pair<uint16_t, double>> points;
+    uint16_t counts;
+    double kelvin;
+
+    while (fp >> counts >> kelvin)
+    {
+        points.push_back({counts, kelvin});
+    }
+
+    if (points.empty())
+        return false;
+
+    set_table(std::move(points));
+
+    return true;
+}
+
+auto RadiometricConverter::set_resolution(double kelvin) -> void
+{
+    _resolution = kelvin;
+
+    build_luts();
+}
+
+auto RadiometricConverter::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    if (frame->format.bits_per_pixel != 16 || frame->compression != VideoFrame::Compression::NONE)
+        return frame;
+
+    size_t width = (size_t)frame->format.width * frame->format.num_components;
+    size_t height = frame->format.height > _ignored_rows ? frame->format.height - _ignored_rows : 0;
+
+    if (!width)
+        return frame;
+
+    height = std::min(height, frame->buffer.size() / sizeof(uint16_t) / width);
+
+    const size_t count = width * height;
+    const auto *px = (const uint16_t*)frame->buffer.data();
+
+    VideoFramePtr ret;
+    Stats stats{};
+    double sum;
+
+    if (_output == Output::FIXED)
+    {
+        ret = frame;
+
+        uint16_t min, max;
+        sum = convert<simd::u16>(px, (uint16_t*)ret->buffer.data(), count, _fixed_lut.data(), min, max);
+
+        stats.min = min * _resolution;
+        stats.max = max * _resolution;
+        sum *= _resolution;
+    }
+    else
+    {
+        ret = std::make_shared<VideoFrame>();
+        ret->format = frame->format;
+        ret->format.height = height;
+        ret->format.bits_per_pixel = 32;
+        ret->sample_type = VideoFrame::SampleType::FLOAT;
+        ret->buffer.reserve(count * sizeof(float) + frame->metadata.telemetry_size);
+        ret->buffer.resize(count * sizeof(float));
+
+        float min, max;
+        sum = convert<simd::f32>(px, (float*)ret->buffer.data(), count, _float_lut.data(), min, max);
+
+        stats.min = min;
+        stats.max = max;
+
+        ret->inherit_metadata(*frame);
+    }
+
+    if (count)
+        stats.mean = sum / count;
+    else
+        stats = {};
+
+    // Frame stats are in stored sample units, FIXED samples are scaled by
+    // the resolution
+    double unit = _output == Output::FIXED ? _resolution : 1.0;
+
+    ret->metadata.has_stats = count > 0;
+    ret->metadata.min = stats.min / unit;
+    ret->metadata.max = stats.max / unit;
+    ret->metadata.mean = stats.mean / unit;
+
+    std::lock_guard<std::mutex> lock(_stats_mtx);
+    _stats = stats;
+
+    return ret;
+}
+
+auto RadiometricConverter::mutates_frame() const -> bool
+{
+    return _output == Output::FIXED;
+}
+
+auto RadiometricConverter::last_stats() const -> Stats
+{
+    std::lock_guard<std::mutex> lock(_stats_mtx);
+
+    return _stats;
+}
+
+auto RadiometricConverter::build_luts() -> void
+{
+    if (_output == Output::FIXED)
+    {
+        _fixed_lut.resize(_kelvin.size());
+
+        for (size_t v = 0; v < _kelvin.size(); v++)
+        {
+            _fixed_lut[v] = std::clamp(std::lround(_kelvin[v] / _resolution), 0L, 65535L);
+        }
+    }
+    else
+    {
+        _float_lut.assign(_kelvin.begin(), _kelvin.end());
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "VideoFrame.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Maps raw 16-bit radiometric counts to temperature. The calibration is
+// evaluated once into a table of all 65536 counts, so per pixel the cost is
+// a single lookup whatever the calibration. Output is either fixed-point
+// 16-bit (count * resolution = kelvin) or 32-bit float kelvin.
+//
+// Rows at the bottom of the frame (sensor telemetry) are copied unchanged in
+// FIXED mode and dropped in FLOAT mode. Telemetry already split off with
+// TelemetrySplitter is kept in both.
+class RadiometricConverter : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    enum class Output
+    {
+        FIXED,
+        FLOAT,
+    };
+
+    // Kelvin, over the converted rows of the last frame
+    struct Stats
+    {
+        double min;
+        double max;
+        double mean;
+    };
+
+    // Defaults to the TLinear radiometric mode, counts in centikelvin
+    RadiometricConverter(Output output = Output::FIXED, uint16_t ignored_rows = 0);
+
+    // kelvin = c[0] + c[1] * counts + c[2] * counts^2 + ...
+    auto set_polynomial(const std::vector<double> &coeffs) -> void;
+
+    // (counts, kelvin) points, linearly interpolated and extended flat past
+    // both ends
+    auto set_table(std::vector<std::pair<uint16_t, double>> points) -> void;
+
+    // One "counts kelvin" pair per line
+    auto load_table(const std::string &path) -> bool;
+
+    // Kelvin per output count in FIXED mode, 0.01 by default
+    auto set_resolution(double kelvin) -> void;
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+    auto mutates_frame() const -> bool override;
+
+    auto last_stats() const -> Stats;
+
+private:
+    Output _output;
+    uint16_t _ignored_rows;
+    double _resolution;
+
+    std::vector<double> _kelvin;
+    std::vector<uint16_t> _fixed_lut;
+    std::vector<float> _float_lut;
+
+    mutable std::mutex _stats_mtx;
+    Stats _stats;
+
+    auto build_luts() -> void;
+};
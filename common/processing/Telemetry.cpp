@@ -0,0 +1,86 @@
+#include "processing/Telemetry.h"
+#include <cstring>
+
+static auto row_size(const VideoFrame::Format &format) -> size_t
+{
+    return (size_t)format.width * format.num_components * ((format.bits_per_pixel + 7) / 8);
+}
+
+auto joined_telemetry_rows(const VideoFrame &frame) -> uint16_t
+{
+    const auto &metadata = frame.metadata;
+    size_t row_bytes = row_size(frame.format);
+
+    if (!metadata.telemetry_rows || !row_bytes)
+        return 0;
+
+    // Still at the width it was split at
+    if (metadata.telemetry_size == metadata.telemetry_rows * row_bytes)
+        return metadata.telemetry_rows;
+
+    return (metadata.telemetry_size + row_bytes - 1) / row_bytes;
+}
+
+TelemetrySplitter::TelemetrySplitter(uint16_t rows):
+    _rows(rows)
+{
+}
+
+auto TelemetrySplitter::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    auto &format = frame->format;
+    size_t row_bytes = row_size(format);
+
+    if (frame->metadata.telemetry_rows || format.height <= _rows || frame->buffer.size() < format.height * row_bytes)
+        return frame;
+
+    format.height -= _rows;
+
+    frame->metadata.telemetry_rows = _rows;
+    frame->metadata.telemetry_offset = format.height * row_bytes;
+    frame->metadata.telemetry_size = _rows * row_bytes;
+
+    return frame;
+}
+
+auto TelemetrySplitter::mutates_frame() const -> bool
+{
+    return true;
+}
+
+auto TelemetryJoiner::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    auto &metadata = frame->metadata;
+
+    if (!metadata.telemetry_rows || metadata.telemetry_offset + metadata.telemetry_size > frame->buffer.size())
+        return frame;
+
+    size_t image_size = frame->format.height * row_size(frame->format);
+    uint16_t rows = joined_telemetry_rows(*frame);
+    size_t joined_size = rows * row_size(frame->format);
+
+    // Decoded frames already have the telemetry right behind the image
+    if (metadata.telemetry_offset != image_size)
+    {
+        if (frame->buffer.size() < image_size + metadata.telemetry_size)
+            frame->buffer.resize(image_size + metadata.telemetry_size);
+
+        memmove(frame->buffer.data() + image_size, frame->buffer.data() + metadata.telemetry_offset, metadata.telemetry_size);
+    }
+
+    // Padding of the last row when the frame's rows don't divide it
+    frame->buffer.resize(image_size + metadata.telemetry_size);
+    frame->buffer.resize(image_size + joined_size, 0);
+    frame->format.height += rows;
+
+    metadata.telemetry_rows = 0;
+    metadata.telemetry_offset = 0;
+    metadata.telemetry_size = 0;
+
+    return frame;
+}
+
+auto TelemetryJoiner::mutates_frame() const -> bool
+{
+    return true;
+}
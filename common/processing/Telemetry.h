@@ -0,0 +1,38 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "VideoFrame.h"
+#include <cstdint>
+
+// Moves the sensor telemetry rows at the bottom of the frame out of the
+// image. Nothing is copied: the frame height shrinks and the rows stay where
+// they are, referenced from the frame metadata. Components after this one
+// see only image rows, encoders keep the telemetry raw next to the
+// codestream.
+class TelemetrySplitter : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    TelemetrySplitter(uint16_t rows);
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+    auto mutates_frame() const -> bool override;
+
+private:
+    uint16_t _rows;
+};
+
+// Rows the split telemetry takes up once joined below the image. Frames
+// downscaled or cropped after the split are narrower than the sensor rows
+// the telemetry was cut from, it then spans more rows of the frame's width.
+auto joined_telemetry_rows(const VideoFrame &frame) -> uint16_t;
+
+// Puts split telemetry rows back below the image, for consumers that expect
+// the sensor's full frame. Telemetry of a frame narrower than the sensor is
+// kept whole and laid out over joined_telemetry_rows() rows, the last one
+// zero padded.
+class TelemetryJoiner : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+    auto mutates_frame() const -> bool override;
+};
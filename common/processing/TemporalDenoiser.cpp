@@ -0,0 +1,113 @@
+#include "processing/TemporalDenoiser.h"
+#include "simd/Simd.h"
+#include <algorithm>
+#include <cstring>
+
+TemporalDenoiser::TemporalDenoiser(uint16_t threshold, unsigned strength, uint16_t ignored_rows):
+    _ignored_rows(ignored_rows),
+    _limit(0),
+    _seed(true)
+{
+    set_threshold(threshold);
+    set_strength(strength);
+}
+
+auto TemporalDenoiser::set_threshold(uint16_t threshold) -> void
+{
+    // Blended differences have to fit a signed 16-bit lane
+    _threshold = std::min<uint16_t>(threshold, 0x3fff);
+}
+
+auto TemporalDenoiser::set_strength(unsigned strength) -> void
+{
+    _strength = std::clamp(strength, 1u, 8u);
+}
+
+auto TemporalDenoiser::reset() -> void
+{
+    _ref.clear();
+}
+
+auto TemporalDenoiser::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    // Other depths pass through unfiltered
+    if (frame->format.bits_per_pixel != 16)
+        return frame;
+
+    process_frame_in_place(*frame);
+
+    return frame;
+}
+
+auto TemporalDenoiser::process_frame_in_place(VideoFrame &frame) -> void
+{
+    begin_frame(frame);
+    process_block((uint16_t*)frame.buffer.data(), 0, _limit);
+}
+
+auto TemporalDenoiser::mutates_frame() const -> bool
+{
+    return true;
+}
+
+auto TemporalDenoiser::begin_frame(VideoFrame &frame) -> void
+{
+    size_t width = (size_t)frame.format.width * frame.format.num_components;
+    size_t height = frame.format.height > _ignored_rows ? frame.format.height - _ignored_rows : 0;
+
+    _limit = std::min(width * height, frame.buffer.size() / sizeof(uint16_t));
+    _seed = _ref.size() != _limit;
+
+    if (_seed)
+        _ref.resize(_limit);
+}
+
+auto TemporalDenoiser::process_block(uint16_t *px, size_t offset, size_t count) -> void
+{
+    if (offset >= _limit)
+        return;
+
+    count = std::min(count, _limit - offset);
+    uint16_t *ref = _ref.data() + offset;
+
+    if (_seed)
+    {
+        memcpy(ref, px, count * sizeof(uint16_t));
+        return;
+    }
+
+    using V = simd::u16;
+    using S = simd::i16;
+    constexpr size_t n = simd::lanes<V>;
+
+    const V thr = simd::splat<V>(_threshold);
+    const V round = simd::splat<V>(1 << (_strength - 1));
+    const int shift = _strength;
+
+    size_t i = 0;
+
+    // The difference wraps in 16 bits but is only used where it is within the
+    // threshold, so reading it as signed is exact there
+    for (; i + n <= count; i += n)
+    {
+        V v = simd::load<V>(px + i);
+        V r = simd::load<V>(ref + i);
+
+        V dist = simd::max(v, r) - simd::min(v, r);
+        V blended = r + (V)((S)(v - r + round) >> shift);
+        V out = dist <= thr ? blended : v;
+
+        simd::store(px + i, out);
+        simd::store(ref + i, out);
+    }
+
+    for (; i < count; i++)
+    {
+        int d = (int)px[i] - ref[i];
+
+        if (std::abs(d) <= _threshold)
+            px[i] = ref[i] + ((d + (1 << (_strength - 1))) >> _strength);
+
+        ref[i] = px[i];
+    }
+}
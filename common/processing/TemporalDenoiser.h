@@ -0,0 +1,41 @@
+#pragma once
+
+#include "FramePipeline.h"
+#include "VideoFrame.h"
+#include <cstdint>
+#include <vector>
+
+// Motion-adaptive recursive filter for 16-bit frames. Every pixel is
+// compared against a running reference: small differences are treated as
+// noise and only 1/2^strength of them is let through, larger ones as motion
+// and the new value replaces the reference.
+//
+// Usable as a FramePipeline component or as a block stage of a
+// StaticFramePipeline, in both cases the frame is filtered in place.
+class TemporalDenoiser : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    TemporalDenoiser(uint16_t threshold = 64, unsigned strength = 2, uint16_t ignored_rows = 0);
+
+    auto set_threshold(uint16_t threshold) -> void;
+    auto set_strength(unsigned strength) -> void;
+
+    // Next frame is taken as is and restarts the filter
+    auto reset() -> void;
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+    auto process_frame_in_place(VideoFrame &frame) -> void;
+    auto mutates_frame() const -> bool override;
+
+    auto begin_frame(VideoFrame &frame) -> void;
+    auto process_block(uint16_t *px, size_t offset, size_t count) -> void;
+
+private:
+    uint16_t _threshold;
+    unsigned _strength;
+    uint16_t _ignored_rows;
+
+    std::vector<uint16_t> _ref;
+    size_t _limit;
+    bool _seed;
+};
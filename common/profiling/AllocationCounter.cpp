@@ -0,0 +1,78 @@
+#include "profiling/AllocationCounter.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+// Replaces the global allocation functions so FramePipeline can attribute
+// heap allocations to the component that made them. Counting is a single
+// thread-local increment.
+
+static thread_local uint64_t _allocation_count = 0;
+
+auto thread_allocation_count() -> uint64_t
+{
+    return _allocation_count;
+}
+
+static void *counted_alloc(std::size_t size)
+{
+    ++_allocation_count;
+
+    if (void *ptr = std::malloc(size ? size : 1); ptr)
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+static void *counted_aligned_alloc(std::size_t size, std::align_val_t align)
+{
+    ++_allocation_count;
+
+    void *ptr = nullptr;
+
+    if (posix_memalign(&ptr, std::max(sizeof(void*), (std::size_t)align), size ? size : 1) == 0)
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size)
+{
+    return counted_alloc(size);
+}
+
+void *operator new[](std::size_t size)
+{
+    return counted_alloc(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++_allocation_count;
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++_allocation_count;
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new(std::size_t size, std::align_val_t align)
+{
+    return counted_aligned_alloc(size, align);
+}
+
+void *operator new[](std::size_t size, std::align_val_t align)
+{
+    return counted_aligned_alloc(size, align);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
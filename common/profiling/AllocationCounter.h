@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef COUNT_ALLOCATIONS
+// Number of operator new calls made by the calling thread so far
+auto thread_allocation_count() -> uint64_t;
+#else
+// Only counted when built with COUNT_ALLOCATIONS, see common/CMakeLists.txt
+inline auto thread_allocation_count() -> uint64_t
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "ThreadConfig.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeinfo>
+
+// Counters for a single pipeline component. Updated by whichever thread runs
+// the component and read concurrently by the reporter, hence the atomics.
+class ComponentStats
+{
+public:
+    // Latency bucket i counts calls that took [2^i, 2^(i+1)) nanoseconds
+    static constexpr size_t num_latency_buckets = 40;
+
+    struct Snapshot
+    {
+        std::string name;
+        uint64_t calls;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+        uint64_t allocations;
+        std::array<uint64_t, num_latency_buckets> latency_hist;
+
+        auto mean_ns() const -> uint64_t
+        {
+            return calls ? total_ns / calls : 0;
+        }
+
+        // Upper bound of the histogram bucket containing the given percentile
+        auto percentile_ns(double pct) const -> uint64_t
+        {
+            uint64_t target = calls * pct / 100.0, seen = 0;
+
+            for (size_t i = 0; i < latency_hist.size(); i++)
+            {
+                if (seen += latency_hist[i]; seen > target)
+                    return (2ull << i) - 1;
+            }
+
+            return max_ns;
+        }
+    };
+
+    ComponentStats(const std::string &name): _name(name) {}
+
+    auto record(uint64_t ns, uint64_t bytes_in, uint64_t bytes_out, uint64_t allocations) -> void
+    {
+        _calls.fetch_add(1, std::memory_order_relaxed);
+        _total_ns.fetch_add(ns, std::memory_order_relaxed);
+        _bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+        _bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+        _allocations.fetch_add(allocations, std::memory_order_relaxed);
+
+        size_t bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+        _latency_hist[std::min(bucket, num_latency_buckets - 1)].fetch_add(1, std::memory_order_relaxed);
+
+        for (uint64_t max = _max_ns.load(std::memory_order_relaxed); ns > max;)
+        {
+            if (_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+                break;
+        }
+    }
+
+    auto snapshot() const -> Snapshot
+    {
+        Snapshot ret;
+        ret.name = _name;
+        ret.calls = _calls.load(std::memory_order_relaxed);
+        ret.total_ns = _total_ns.load(std::memory_order_relaxed);
+        ret.max_ns = _max_ns.load(std::memory_order_relaxed);
+        ret.bytes_in = _bytes_in.load(std::memory_order_relaxed);
+        ret.bytes_out = _bytes_out.load(std::memory_order_relaxed);
+        ret.allocations = _allocations.load(std::memory_order_relaxed);
+
+        for (size_t i = 0; i < num_latency_buckets; i++)
+        {
+            ret.latency_hist[i] = _latency_hist[i].load(std::memory_order_relaxed);
+        }
+
+        return ret;
+    }
+
+    auto name() const -> const std::string&
+    {
+        return _name;
+    }
+
+private:
+    std::string _name;
+    std::atomic<uint64_t> _calls{0};
+    std::atomic<uint64_t> _total_ns{0};
+    std::atomic<uint64_t> _max_ns{0};
+    std::atomic<uint64_t> _bytes_in{0};
+    std::atomic<uint64_t> _bytes_out{0};
+    std::atomic<uint64_t> _allocations{0};
+    std::array<std::atomic<uint64_t>, num_latency_buckets> _latency_hist{};
+};
+
+inline auto demangled_type_name(const std::type_info &type) -> std::string
+{
+    int status;
+    char *name = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+
+    if (status != 0)
+        return type.name();
+
+    std::string ret{name};
+    free(name);
+
+    return ret;
+}
+
+inline auto print_stats_header(FILE *fp) -> void
+{
+    fprintf(fp, "%-28s %10s %10s %10s %10s %10s %12s %12s %10s\n",
+            "component", "calls", "mean_us", "p50_us", "p99_us", "max_us",
+            "in_kb", "out_kb", "allocs");
+}
+
+inline auto print_stats(FILE *fp, const ComponentStats::Snapshot &stats) -> void
+{
+    fprintf(fp, "%-28s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f %12" PRIu64 " %12" PRIu64 " ",
+            stats.name.c_str(), stats.calls,
+            stats.mean_ns() / 1e3, stats.percentile_ns(50) / 1e3,
+            stats.percentile_ns(99) / 1e3, stats.max_ns / 1e3,
+            stats.bytes_in / 1024, stats.bytes_out / 1024);
+
+    // Allocations per call, only measured when built with COUNT_ALLOCATIONS
+#ifdef COUNT_ALLOCATIONS
+    fprintf(fp, "%10.2f\n", stats.calls ? (double)stats.allocations / stats.calls : 0.0);
+#else
+    fprintf(fp, "%10s\n", "-");
+#endif
+}
+
+// Periodically calls a dump function with stdout or an output file
+class StatsReporter
+{
+public:
+    using DumpFunction = std::function<void(FILE*)>;
+
+    StatsReporter(std::chrono::milliseconds interval, const std::string &path, const DumpFunction &dump):
+        _interval(interval), _path(path), _dump(dump), _stop(false)
+    {
+        _thread = std::thread([this](){ run(); });
+    }
+
+    ~StatsReporter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = true;
+        }
+
+        _cv.notify_all();
+        _thread.join();
+    }
+
+private:
+    std::chrono::milliseconds _interval;
+    std::string _path;
+    DumpFunction _dump;
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _stop;
+    std::thread _thread;
+
+    auto run() -> void
+    {
+        configure_current_thread("stats");
+
+        std::unique_lock<std::mutex> lock(_mtx);
+
+        while (!_cv.wait_for(lock, _interval, [this](){ return _stop; }))
+        {
+            FILE *fp = _path.empty() ? stdout : fopen(_path.c_str(), "a");
+
+            if (!fp)
+                continue;
+
+            fprintf(fp, "--- %ld\n", (long)std::chrono::duration_cast<std::chrono::seconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count());
+            _dump(fp);
+            fflush(fp);
+
+            if (fp != stdout)
+                fclose(fp);
+        }
+    }
+};
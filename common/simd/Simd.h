@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+// Thin layer over GCC/Clang vector extensions. The same source compiles to
+// SSE2/AVX2 on x86 and NEON on ARM, with the width picked at compile time.
+namespace simd
+{
+
+#if defined(__AVX2__)
+constexpr size_t width = 32;
+#else
+constexpr size_t width = 16;
+#endif
+
+using u8 = uint8_t __attribute__((vector_size(width)));
+using u16 = uint16_t __attribute__((vector_size(width)));
+using i16 = int16_t __attribute__((vector_size(width)));
+using u32 = uint32_t __attribute__((vector_size(width)));
+using i32 = int32_t __attribute__((vector_size(width)));
+using f32 = float __attribute__((vector_size(width)));
+
+template<typename V>
+using lane_t = std::remove_cv_t<std::remove_reference_t<decltype(std::declval<V>()[0])>>;
+
+template<typename V>
+constexpr size_t lanes = sizeof(V) / sizeof(lane_t<V>);
+
+template<typename V, typename T>
+inline auto load(const T *ptr) -> V
+{
+    V ret;
+    memcpy(&ret, ptr, sizeof ret);
+
+    return ret;
+}
+
+template<typename V, typename T>
+inline auto store(T *ptr, const V &v) -> void
+{
+    memcpy(ptr, &v, sizeof v);
+}
+
+template<typename V, typename T>
+inline auto splat(T value) -> V
+{
+    return V{} + (lane_t<V>)value;
+}
+
+template<typename V>
+inline auto min(const V &a, const V &b) -> V
+{
+    return a < b ? a : b;
+}
+
+template<typename V>
+inline auto max(const V &a, const V &b) -> V
+{
+    return a > b ? a : b;
+}
+
+template<typename V>
+inline auto clamp(const V &v, const V &lo, const V &hi) -> V
+{
+    return min(max(v, lo), hi);
+}
+
+// a - b, clamped at zero for unsigned lanes
+template<typename V>
+inline auto subs(const V &a, const V &b) -> V
+{
+    return a > b ? a - b : V{};
+}
+
+}
@@ -0,0 +1,12 @@
+#include "storage/IVideoReader.h"
+#include "storage/VideoContainerReader.h"
+#include "storage/VideoSequenceReader.h"
+#include <filesystem>
+
+auto open_video_reader(const std::string &path) -> IVideoReaderPtr
+{
+    if (std::filesystem::is_directory(path))
+        return std::make_unique<VideoSequenceReader>(path);
+
+    return std::make_unique<VideoContainerReader>(path);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "FramePool.h"
+#include "VideoFrame.h"
+#include <memory>
+#include <string>
+
+// Access to a recording, whatever its on-disk layout
+class IVideoReader
+{
+public:
+    virtual ~IVideoReader() = default;
+
+    virtual auto num_frames() const -> size_t = 0;
+
+    // Moves the read position, rewind() is seek(0)
+    virtual auto seek(size_t idx) -> void = 0;
+    virtual auto rewind() -> void = 0;
+
+    // Decoded frame at the read position, nullptr past the end
+    virtual auto read_frame() -> VideoFramePtr = 0;
+
+    // Decoded frame idx, leaves the read position alone. Safe to call from
+    // several threads at once. With a pool, the frame and its buffer are
+    // taken from it.
+    virtual auto read_frame(size_t idx, FramePool *pool = nullptr) const -> VideoFramePtr = 0;
+
+    // Frame idx as stored, still compressed, for passing it on without a
+    // decode. Thread safety and pool as read_frame(idx).
+    virtual auto read_stored_frame(size_t idx, FramePool *pool = nullptr) const -> VideoFramePtr = 0;
+};
+
+using IVideoReaderPtr = std::unique_ptr<IVideoReader>;
+
+// Container file or frame-per-file directory, depending on what path is
+auto open_video_reader(const std::string &path) -> IVideoReaderPtr;
@@ -0,0 +1,290 @@
+#include "storage/PreEventRecorder.h"
+#include "ThreadConfig.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+
+namespace
+{
+
+auto now_ns() -> int64_t
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+PreEventRecorder::PreEventRecorder(const std::string &path, const PreEventConfig &config):
+    _path(path),
+    _config(config),
+    _arena(new uint8_t[config.arena_size]),
+    _slots(std::max<size_t>(config.max_frames, 1)),
+    _write_frame(std::make_shared<VideoFrame>())
+{
+    _encoder.set_frame_pool(&_encoded_pool);
+
+    std::error_code err; // ignored
+    std::filesystem::create_directories(_path, err);
+
+    _thread = std::thread([this](){ run(); });
+}
+
+PreEventRecorder::~PreEventRecorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+    }
+
+    _cv.notify_all();
+    _thread.join();
+}
+
+auto PreEventRecorder::process_frame(const VideoFramePtr &frame) -> VideoFramePtr
+{
+    if (!frame || frame->buffer.empty())
+        return frame;
+
+    VideoFramePtr stored = frame;
+
+    if (frame->compression == VideoFrame::Compression::NONE)
+    {
+        if (memcmp(&frame->format, &_encoder_format, sizeof _encoder_format) != 0)
+        {
+            _encoder.set_frame_format(frame->format);
+            _encoder_format = frame->format;
+        }
+
+        stored = _encoder.process_frame(frame);
+    }
+
+    store(*stored, now_ns());
+
+    return frame;
+}
+
+auto PreEventRecorder::trigger() -> void
+{
+    _triggered.store(true, std::memory_order_release);
+}
+
+auto PreEventRecorder::buffered_frames() const -> size_t
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+
+    return _end - _first;
+}
+
+auto PreEventRecorder::buffered_bytes() const -> size_t
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+
+    return _bytes;
+}
+
+auto PreEventRecorder::events() const -> uint64_t
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+
+    return _event;
+}
+
+auto PreEventRecorder::frames_written() const -> uint64_t
+{
+    return _frames_written.load(std::memory_order_relaxed);
+}
+
+auto PreEventRecorder::dropped_frames() const -> uint64_t
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+auto PreEventRecorder::dump_stats(FILE *fp) const -> void
+{
+    fprintf(fp, "pre-event: buffered %zu frames %zu bytes, events %" PRIu64 ", written %" PRIu64 ", dropped %" PRIu64 "\n",
+            buffered_frames(), buffered_bytes(), events(), frames_written(), dropped_frames());
+}
+
+auto PreEventRecorder::slot(uint64_t n) -> Slot&
+{
+    return _slots[n % _slots.size()];
+}
+
+auto PreEventRecorder::store(const VideoFrame &frame, int64_t now) -> void
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+
+    if (_triggered.exchange(false, std::memory_order_acquire))
+    {
+        // Everything still buffered that no earlier event has taken is the
+        // new event's pre-event window
+        if (!_event || now > _event_end_ns)
+        {
+            _event++;
+
+            for (uint64_t n = std::max(_first, _event_slots_end); n < _end; n++)
+            {
+                slot(n).event = _event;
+                _pending++;
+            }
+
+            _event_slots_end = _end;
+            _cv.notify_one();
+        }
+
+        _event_end_ns = now + (int64_t)(_config.post_event_s * 1e9);
+    }
+
+    int64_t window_start = now - (int64_t)(_config.pre_event_s * 1e9);
+
+    while (_first < _end && !slot(_first).event && slot(_first).arrival_ns < window_start)
+        evict();
+
+    size_t size = frame.buffer.size();
+    size_t offset;
+
+    while (_end - _first == _slots.size() || !allocate(size, offset))
+    {
+        if (_first == _end || slot(_first).event || size > _config.arena_size)
+        {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        evict();
+    }
+
+    bool in_event = _event && now <= _event_end_ns;
+
+    auto &s = slot(_end);
+    s.offset = offset;
+    s.size = size;
+    s.arrival_ns = now;
+    s.event = in_event ? _event : 0;
+    s.format = frame.format;
+    s.compression = frame.compression;
+    s.sample_type = frame.sample_type;
+    s.origin_x = frame.origin_x;
+    s.origin_y = frame.origin_y;
+    s.metadata = frame.metadata;
+
+    memcpy(_arena.get() + offset, frame.buffer.data(), size);
+
+    _end++;
+    _bytes += size;
+    _arena_tail = offset + size;
+
+    if (!in_event)
+        return;
+
+    _pending++;
+    _event_slots_end = _end;
+
+    lock.unlock();
+    _cv.notify_one();
+}
+
+// The arena is used as a ring, frames are never split across its end
+auto PreEventRecorder::allocate(size_t size, size_t &offset) -> bool
+{
+    if (_first == _end)
+    {
+        _arena_tail = 0;
+        offset = 0;
+
+        return size <= _config.arena_size;
+    }
+
+    size_t head = slot(_first).offset;
+
+    if (_arena_tail > head)
+    {
+        if (_config.arena_size - _arena_tail >= size)
+            offset = _arena_tail;
+        else if (head >= size)
+            offset = 0;
+        else
+            return false;
+
+        return true;
+    }
+
+    if (head - _arena_tail < size)
+        return false;
+
+    offset = _arena_tail;
+
+    return true;
+}
+
+auto PreEventRecorder::evict() -> void
+{
+    _bytes -= slot(_first).size;
+    _first++;
+}
+
+auto PreEventRecorder::run() -> void
+{
+    configure_current_thread("pre-event");
+
+    while (1)
+    {
+        uint64_t event;
+
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _cv.wait(lock, [this](){ return _stop || _pending; });
+
+            if (!_pending)
+                return;
+
+            _write_next = std::max(_write_next, _first);
+
+            while (!slot(_write_next).event)
+                _write_next++;
+
+            // Copied out so the slot can be reused while the disk is slow,
+            // the buffer keeps its capacity
+            auto &s = slot(_write_next++);
+            auto &frame = *_write_frame;
+
+            frame.buffer.assign(_arena.get() + s.offset, _arena.get() + s.offset + s.size);
+            frame.format = s.format;
+            frame.compression = s.compression;
+            frame.sample_type = s.sample_type;
+            frame.origin_x = s.origin_x;
+            frame.origin_y = s.origin_y;
+            frame.metadata = s.metadata;
+
+            event = s.event;
+            s.event = 0;
+            _pending--;
+        }
+
+        if (event != _writer_event)
+            open_event_dir(event);
+
+        _writer->write_frame(_unpacker.process_frame(_write_frame));
+        _frames_written.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+auto PreEventRecorder::open_event_dir(uint64_t event) -> void
+{
+    char name[64];
+    time_t now = time(nullptr);
+    tm local;
+
+    localtime_r(&now, &local);
+    size_t len = strftime(name, sizeof name, "%Y%m%d-%H%M%S", &local);
+    snprintf(name + len, sizeof name - len, "-%" PRIu64, event);
+
+    const auto dir = std::filesystem::path(_path) / name;
+    printf("pre-event recorder: event %" PRIu64 " to %s\n", event, dir.c_str());
+
+    _writer = std::make_unique<VideoSequenceWriter>(dir.string());
+    _writer_event = event;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "VideoFrame.h"
+#include "compression/BitPack.h"
+#include "compression/JpegLs.h"
+#include "FramePipeline.h"
+#include "storage/VideoSequenceWriter.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct PreEventConfig
+{
+    // Kept before a trigger, and recorded after it
+    double pre_event_s{30};
+    double post_event_s{10};
+
+    // Codestreams are copied into an arena of this size, the oldest frames
+    // are given up early when it is full
+    size_t arena_size{256 << 20};
+    size_t max_frames{4096};
+};
+
+// Keeps the last pre_event_s seconds of compressed frames in memory and only
+// touches the disk when triggered. Each event is written to its own
+// directory under path in VideoSequenceWriter's format, starting with the
+// frames buffered before the trigger and ending post_event_s seconds after
+// it. A trigger during an event extends it.
+//
+// Uncompressed frames are JPEG-LS encoded on the caller's thread into a
+// recycled frame, and codestreams are copied into a fixed arena, so no frame
+// buffer is allocated per frame. Events are written by a thread of their own,
+// JPEG-LS codestreams and their telemetry as stored. Frames it has not
+// written yet are never evicted, new frames are dropped instead.
+class PreEventRecorder : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    PreEventRecorder(const std::string &path, const PreEventConfig &config = {});
+    ~PreEventRecorder();
+
+    PreEventRecorder(const PreEventRecorder&) = delete;
+    PreEventRecorder& operator=(const PreEventRecorder&) = delete;
+
+    auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr override;
+
+    // Takes effect with the next frame. Only sets a flag, so it is safe from
+    // any thread and from signal handlers.
+    auto trigger() -> void;
+
+    auto buffered_frames() const -> size_t;
+    auto buffered_bytes() const -> size_t;
+    auto events() const -> uint64_t;
+    auto frames_written() const -> uint64_t;
+
+    // Frames the arena had no room for because they were still to be written
+    auto dropped_frames() const -> uint64_t;
+
+    auto dump_stats(FILE *fp) const -> void;
+
+private:
+    struct Slot
+    {
+        size_t offset;
+        size_t size;
+        int64_t arrival_ns;
+        uint64_t event; // 0 once written, or when not part of an event
+        VideoFrame::Format format;
+        VideoFrame::Compression compression;
+        VideoFrame::SampleType sample_type;
+        uint16_t origin_x;
+        uint16_t origin_y;
+        VideoFrame::Metadata metadata;
+    };
+
+    std::string _path;
+    PreEventConfig _config;
+
+    FramePool _encoded_pool{2};
+    JpegLsEncoder _encoder;
+    VideoFrame::Format _encoder_format{};
+
+    std::unique_ptr<uint8_t[]> _arena;
+    std::vector<Slot> _slots;
+
+    // Slots are numbered from the first frame ever stored, slot n lives in
+    // _slots[n % max_frames]
+    mutable std::mutex _mtx;
+    std::condition_variable _cv;
+    uint64_t _first{0};
+    uint64_t _end{0};
+    size_t _arena_tail{0};
+    size_t _bytes{0};
+    uint64_t _event{0};
+    int64_t _event_end_ns{0};
+    uint64_t _event_slots_end{0}; // slots before it belong to earlier events
+    size_t _pending{0};
+    uint64_t _write_next{0};
+    bool _stop{false};
+
+    std::atomic<bool> _triggered{false};
+    std::atomic<uint64_t> _frames_written{0};
+    std::atomic<uint64_t> _dropped{0};
+
+    // Owned by the writer thread
+    VideoFramePtr _write_frame;
+    BitUnpacker _unpacker;
+    std::unique_ptr<VideoSequenceWriter> _writer;
+    uint64_t _writer_event{0};
+    std::thread _thread;
+
+    auto slot(uint64_t n) -> Slot&;
+    auto store(const VideoFrame &frame, int64_t now_ns) -> void;
+    auto allocate(size_t size, size_t &offset) -> bool;
+    auto evict() -> void;
+    auto run() -> void;
+    auto open_event_dir(uint64_t event) -> void;
+};
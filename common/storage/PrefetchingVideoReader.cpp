@@ -0,0 +1,136 @@
+#include "storage/PrefetchingVideoReader.h"
+#include <algorithm>
+
+PrefetchingVideoReader::PrefetchingVideoReader(IVideoReaderPtr reader, size_t depth, size_t num_threads, bool decode):
+    _reader(std::move(reader)),
+    _depth(depth ? depth : 1),
+    _decode(decode),
+    _frame_pool(_depth * 2),
+    _pool(num_threads ? num_threads : std::min<size_t>(_depth, std::max(1u, std::thread::hardware_concurrency())))
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    fill();
+}
+
+auto PrefetchingVideoReader::num_frames() const -> size_t
+{
+    return _reader->num_frames();
+}
+
+auto PrefetchingVideoReader::seek(size_t idx) -> void
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    reset(std::min(idx, _reader->num_frames()));
+}
+
+auto PrefetchingVideoReader::rewind() -> void
+{
+    seek(0);
+}
+
+auto PrefetchingVideoReader::read_frame() -> VideoFramePtr
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+
+    if (_ring.empty())
+        return nullptr;
+
+    auto slot = _ring.front();
+    _cv.wait(lock, [&](){ return slot->ready; });
+
+    _ring.pop_front();
+    _read_idx = (int64_t)slot->idx + _step;
+
+    auto frame = std::move(slot->frame);
+    _free_slots.push_back(std::move(slot));
+    fill();
+
+    return frame;
+}
+
+auto PrefetchingVideoReader::read_frame(size_t idx, FramePool *pool) const -> VideoFramePtr
+{
+    return _reader->read_frame(idx, pool);
+}
+
+auto PrefetchingVideoReader::read_stored_frame(size_t idx, FramePool *pool) const -> VideoFramePtr
+{
+    return _reader->read_stored_frame(idx, pool);
+}
+
+auto PrefetchingVideoReader::set_step(int step) -> void
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+
+    if (step == _step || step == 0)
+        return;
+
+    // Keeps the frame that would have been read next
+    int64_t idx = _ring.empty() ? _read_idx : _ring.front()->idx;
+
+    _step = step;
+    reset(idx);
+}
+
+auto PrefetchingVideoReader::step() const -> int
+{
+    return _step;
+}
+
+auto PrefetchingVideoReader::valid(int64_t idx) const -> bool
+{
+    return idx >= 0 && (size_t)idx < _reader->num_frames();
+}
+
+// Reads still running for the old slots complete into slots nobody reads
+auto PrefetchingVideoReader::reset(int64_t idx) -> void
+{
+    for (auto &slot : _ring)
+    {
+        _free_slots.push_back(std::move(slot));
+    }
+
+    _ring.clear();
+    _read_idx = idx;
+    fill();
+}
+
+auto PrefetchingVideoReader::fill() -> void
+{
+    int64_t next = _ring.empty() ? _read_idx : (int64_t)_ring.back()->idx + _step;
+
+    while (_ring.size() < _depth && valid(next))
+    {
+        auto slot = acquire_slot();
+        slot->idx = next;
+        _ring.push_back(slot);
+
+        _pool.submit([this, slot](){
+            auto frame = _decode ? _reader->read_frame(slot->idx, &_frame_pool) : _reader->read_stored_frame(slot->idx, &_frame_pool);
+
+            std::lock_guard<std::mutex> lock(_mtx);
+            slot->frame = std::move(frame);
+            slot->ready = true;
+            _cv.notify_all();
+        });
+
+        next += _step;
+    }
+}
+
+auto PrefetchingVideoReader::acquire_slot() -> std::shared_ptr<Slot>
+{
+    // A worker still holding a slot keeps its use count above one
+    auto it = std::find_if(_free_slots.begin(), _free_slots.end(), [](const auto &slot){ return slot.use_count() == 1; });
+
+    if (it == _free_slots.end())
+        return std::make_shared<Slot>();
+
+    auto slot = std::move(*it);
+    _free_slots.erase(it);
+
+    slot->frame = nullptr;
+    slot->ready = false;
+
+    return slot;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "FramePool.h"
+#include "ThreadPool.h"
+#include "storage/IVideoReader.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Reads and decodes the frames ahead of the read position on a worker pool,
+// so read_frame() only waits when the workers fall behind. The read
+// position moves by step frames per read, more than 1 fast-forwards and
+// negative steps play in reverse. Slots and frame buffers are recycled, once
+// the frames read are released nothing is allocated per frame.
+class PrefetchingVideoReader : public IVideoReader
+{
+public:
+    // depth frames are kept in flight, num_threads 0 picks one per core.
+    // Without decode read_frame() returns the frames as stored.
+    PrefetchingVideoReader(IVideoReaderPtr reader, size_t depth = 8, size_t num_threads = 0, bool decode = true);
+
+    auto num_frames() const -> size_t override;
+    auto seek(size_t idx) -> void override;
+    auto rewind() -> void override;
+    auto read_frame() -> VideoFramePtr override;
+    auto read_frame(size_t idx, FramePool *pool = nullptr) const -> VideoFramePtr override;
+    auto read_stored_frame(size_t idx, FramePool *pool = nullptr) const -> VideoFramePtr override;
+
+    // Throws away frames prefetched for the old step
+    auto set_step(int step) -> void;
+    auto step() const -> int;
+
+private:
+    struct Slot
+    {
+        size_t idx;
+        VideoFramePtr frame;
+        bool ready{false};
+    };
+
+    IVideoReaderPtr _reader;
+    size_t _depth;
+    bool _decode;
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::deque<std::shared_ptr<Slot>> _ring;
+
+    // Slots of old reads are only reused once their worker is done with them
+    std::vector<std::shared_ptr<Slot>> _free_slots;
+    FramePool _frame_pool;
+    int64_t _read_idx{0};
+    int _step{1};
+
+    // Destroyed first, finishes the pending reads while the rest is alive
+    ThreadPool _pool;
+
+    auto valid(int64_t idx) const -> bool;
+    auto reset(int64_t idx) -> void;
+    auto fill() -> void;
+    auto acquire_slot() -> std::shared_ptr<Slot>;
+};
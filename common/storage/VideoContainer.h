@@ -0,0 +1,50 @@
+#pragma once
+
+#include "VideoFrame.h"
+#include <cstdint>
+#include <string>
+
+// Single-file recording container. The data file starts with a
+// ContainerHeader and is followed by records, each a RecordHeader and the
+// stored frame bytes (codestream, then raw telemetry if any). Records are
+// only ever appended.
+//
+// A sidecar "<path>.idx" holds one IndexEntry per record, written after the
+// record itself. After a crash the index can only lag behind the data, and
+// readers recover the missing tail by walking the records past the last
+// indexed one.
+
+constexpr char container_magic[8] = {'V', 'I', 'D', 'C', 'O', 'N', 'T', '1'};
+constexpr uint32_t record_magic = 0x46524d45; // "EMRF"
+
+struct ContainerHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct RecordHeader
+{
+    uint32_t magic;
+    uint32_t size; // of the data following this header
+    uint64_t sequence;
+    uint64_t timestamp_ns;
+    VideoFrame::Format format;
+    uint16_t compression;
+    uint16_t telemetry_rows;
+    uint32_t telemetry_offset; // relative to the record data
+    uint32_t telemetry_size;
+    uint32_t reserved;
+};
+
+struct IndexEntry
+{
+    uint64_t offset; // of the record data in the data file
+    RecordHeader header;
+};
+
+inline auto container_index_path(const std::string &path) -> std::string
+{
+    return path + ".idx";
+}
@@ -0,0 +1,250 @@
+#include "storage/VideoContainerReader.h"
+#include "compression/BitPack.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <err.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static auto map_file(const std::string &path, size_t &size) -> const uint8_t*
+{
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd == -1)
+        return nullptr;
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        if (st.st_size == 0)
+            errno = ENODATA;
+
+        close(fd);
+        return nullptr;
+    }
+
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ptr == MAP_FAILED)
+        err(1, "mmap %s", path.c_str());
+
+    size = st.st_size;
+
+    return (const uint8_t*)ptr;
+}
+
+VideoContainerReader::VideoContainerReader(const std::string &path):
+    _path(path),
+    _data_size(0),
+    _index_map_size(0),
+    _num_indexed(0),
+    _read_idx(0)
+{
+    if (_data = map_file(path, _data_size); !_data)
+        err(1, "%s", path.c_str());
+
+    if (_data_size < sizeof(ContainerHeader) || memcmp(_data, container_magic, sizeof container_magic) != 0)
+        errx(1, "%s: not a video container", path.c_str());
+
+    _index = (const IndexEntry*)map_file(container_index_path(path), _index_map_size);
+
+    if (_index)
+    {
+        // A torn last entry, or entries for records that never made it to
+        // the data file, are dropped
+        _num_indexed = _index_map_size / sizeof(IndexEntry);
+
+        while (_num_indexed && !valid_entry(_index[_num_indexed - 1]))
+            --_num_indexed;
+    }
+
+    uint64_t offset = sizeof(ContainerHeader);
+
+    if (_num_indexed)
+    {
+        const auto &last = _index[_num_indexed - 1];
+        offset = last.offset + last.header.size;
+    }
+
+    recover(offset);
+
+    if (!_recovered.empty())
+        warnx("%s: recovered %zu frames missing from the index", path.c_str(), _recovered.size());
+}
+
+VideoContainerReader::~VideoContainerReader()
+{
+    if (_index)
+        munmap((void*)_index, _index_map_size);
+
+    munmap((void*)_data, _data_size);
+}
+
+auto VideoContainerReader::num_frames() const -> size_t
+{
+    return _num_indexed + _recovered.size();
+}
+
+auto VideoContainerReader::view(size_t idx) const -> FrameView
+{
+    const auto &ent = entry(idx);
+
+    return {_data + ent.offset, ent.header.size, &ent.header};
+}
+
+auto VideoContainerReader::seek(size_t idx) -> void
+{
+    _read_idx = std::min(idx, num_frames());
+}
+
+auto VideoContainerReader::seek_time(uint64_t timestamp_ns) -> size_t
+{
+    size_t lo = 0;
+    size_t hi = num_frames();
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (entry(mid).header.timestamp_ns < timestamp_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    _read_idx = lo;
+
+    return lo;
+}
+
+auto VideoContainerReader::rewind() -> void
+{
+    _read_idx = 0;
+}
+
+auto VideoContainerReader::read_frame() -> VideoFramePtr
+{
+    if (_read_idx >= num_frames())
+        return nullptr;
+
+    return read_frame(_read_idx++);
+}
+
+auto VideoContainerReader::read_frame(size_t idx, FramePool *pool) const -> VideoFramePtr
+{
+    if (idx >= num_frames())
+        return nullptr;
+
+    const auto [data, size, header] = view(idx);
+    const size_t image_size = header->telemetry_size ? header->telemetry_offset : size;
+
+    VideoFramePtr ret;
+
+    switch ((VideoFrame::Compression)header->compression)
+    {
+    case VideoFrame::Compression::JPEG_LS:
+        ret = JpegLsDecoder().decode(data, image_size, header->telemetry_size, pool);
+        break;
+    case VideoFrame::Compression::PACKED:
+    {
+        const auto &format = header->format;
+        const size_t count = (size_t)format.width * format.height * format.num_components;
+
+        if (!format.bits_per_pixel || format.bits_per_pixel > 16 || BitPacker::packed_size(count, format.bits_per_pixel) > image_size)
+            errx(1, "%s: frame %zu is corrupt", _path.c_str(), idx);
+
+        ret = acquire_frame(pool);
+        ret->format = format;
+        ret->format.bits_per_pixel = 16;
+        ret->buffer.reserve(count * sizeof(uint16_t) + header->telemetry_size);
+        ret->buffer.resize(count * sizeof(uint16_t));
+
+        BitPacker::unpack(data, count, format.bits_per_pixel, (uint16_t*)ret->buffer.data());
+        break;
+    }
+    case VideoFrame::Compression::NONE:
+        ret = acquire_frame(pool);
+        ret->format = header->format;
+        ret->buffer.assign(data, data + image_size);
+        break;
+    default:
+        errx(1, "%s: unsupported compression %d", _path.c_str(), header->compression);
+    }
+
+    auto &metadata = ret->metadata;
+    metadata.sequence = header->sequence;
+    metadata.capture_time_ns = header->timestamp_ns;
+    metadata.telemetry_rows = header->telemetry_rows;
+
+    if (header->telemetry_size)
+    {
+        metadata.telemetry_offset = ret->buffer.size();
+        metadata.telemetry_size = header->telemetry_size;
+        ret->buffer.insert(ret->buffer.end(), data + header->telemetry_offset, data + header->telemetry_offset + header->telemetry_size);
+    }
+
+    return ret;
+}
+
+auto VideoContainerReader::read_stored_frame(size_t idx, FramePool *pool) const -> VideoFramePtr
+{
+    if (idx >= num_frames())
+        return nullptr;
+
+    const auto [data, size, header] = view(idx);
+
+    auto ret = acquire_frame(pool);
+    ret->buffer.assign(data, data + size);
+    ret->format = header->format;
+    ret->compression = (VideoFrame::Compression)header->compression;
+
+    auto &metadata = ret->metadata;
+    metadata.sequence = header->sequence;
+    metadata.capture_time_ns = header->timestamp_ns;
+    metadata.telemetry_rows = header->telemetry_rows;
+    metadata.telemetry_offset = header->telemetry_offset;
+    metadata.telemetry_size = header->telemetry_size;
+
+    return ret;
+}
+
+auto VideoContainerReader::entry(size_t idx) const -> const IndexEntry&
+{
+    return idx < _num_indexed ? _index[idx] : _recovered[idx - _num_indexed];
+}
+
+auto VideoContainerReader::valid_entry(const IndexEntry &entry) const -> bool
+{
+    if (entry.offset < sizeof(ContainerHeader) + sizeof(RecordHeader) || entry.offset + entry.header.size > _data_size)
+        return false;
+
+    RecordHeader header;
+    memcpy(&header, _data + entry.offset - sizeof header, sizeof header);
+
+    return memcmp(&header, &entry.header, sizeof header) == 0;
+}
+
+// Walks the records from offset on, stops at the first incomplete one
+auto VideoContainerReader::recover(uint64_t offset) -> void
+{
+    while (offset + sizeof(RecordHeader) <= _data_size)
+    {
+        IndexEntry ent;
+        memcpy(&ent.header, _data + offset, sizeof ent.header);
+        ent.offset = offset + sizeof(RecordHeader);
+
+        if (ent.header.magic != record_magic || ent.offset + ent.header.size > _data_size)
+            break;
+
+        if (ent.header.telemetry_size && (uint64_t)ent.header.telemetry_offset + ent.header.telemetry_size > ent.header.size)
+            break;
+
+        _recovered.push_back(ent);
+        offset = ent.offset + ent.header.size;
+    }
+}
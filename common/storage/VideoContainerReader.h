@@ -0,0 +1,56 @@
+#pragma once
+
+#include "VideoFrame.h"
+#include "compression/JpegLs.h"
+#include "storage/IVideoReader.h"
+#include "storage/VideoContainer.h"
+#include <string>
+#include <vector>
+
+// Random access to a container file, see VideoContainer.h. Both files are
+// mapped, records are decoded straight from the mapping.
+class VideoContainerReader : public IVideoReader
+{
+public:
+    struct FrameView
+    {
+        const uint8_t *data;
+        size_t size;
+        const RecordHeader *header;
+    };
+
+    VideoContainerReader(const std::string &path);
+    ~VideoContainerReader();
+
+    VideoContainerReader(const VideoContainerReader&) = delete;
+    VideoContainerReader& operator=(const VideoContainerReader&) = delete;
+
+    auto num_frames() const -> size_t override;
+
+    // Stored record, without copying or decoding it
+    auto view(size_t idx) const -> FrameView;
+
+    auto seek(size_t idx) -> void override;
+
+    // Seeks to the first frame at or after timestamp_ns, returns its index
+    auto seek_time(uint64_t timestamp_ns) -> size_t;
+
+    auto rewind() -> void override;
+    auto read_frame() -> VideoFramePtr override;
+    auto read_frame(size_t idx, FramePool *pool = nullptr) const -> VideoFramePtr override;
+    auto read_stored_frame(size_t idx, FramePool *pool = nullptr) const -> VideoFramePtr override;
+
+private:
+    std::string _path;
+    const uint8_t *_data;
+    size_t _data_size;
+    const IndexEntry *_index;
+    size_t _index_map_size;
+    size_t _num_indexed;
+    std::vector<IndexEntry> _recovered;
+    size_t _read_idx;
+
+    auto entry(size_t idx) const -> const IndexEntry&;
+    auto valid_entry(const IndexEntry &entry) const -> bool;
+    auto recover(uint64_t offset) -> void;
+};
@@ -0,0 +1,319 @@
+#include "storage/VideoContainerWriter.h"
+#include "ThreadConfig.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static auto pwrite_all(int fd, const uint8_t *data, size_t size, uint64_t offset) -> bool
+{
+    while (size)
+    {
+        ssize_t ret = pwrite(fd, data, size, offset);
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        data += ret;
+        size -= ret;
+        offset += ret;
+    }
+
+    return true;
+}
+
+static auto align_up(size_t size, size_t alignment) -> size_t
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+VideoContainerWriter::VideoContainerWriter(const std::string &path, const ContainerWriterConfig &config):
+    _path(path),
+    _config(config),
+    _queue(config.queue_size, config.backpressure)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    if (_config.direct_io)
+    {
+        // Not every filesystem supports it, tmpfs for one
+        if (_data_fd = open(path.c_str(), flags | O_DIRECT, 0644); _data_fd == -1 && errno == EINVAL)
+        {
+            warnx("%s: direct I/O not supported, writing through the page cache", path.c_str());
+            _config.direct_io = false;
+        }
+    }
+
+    if (!_config.direct_io)
+        _data_fd = open(path.c_str(), flags, 0644);
+
+    if (_data_fd == -1)
+        err(1, "%s", path.c_str());
+
+    const auto index_path = container_index_path(path);
+
+    if (_index_fd = open(index_path.c_str(), flags, 0644); _index_fd == -1)
+        err(1, "%s", index_path.c_str());
+
+    reserve(std::max<size_t>(_config.batch_size, io_alignment));
+
+    ContainerHeader header{};
+    memcpy(header.magic, container_magic, sizeof header.magic);
+    header.version = 1;
+
+    append_bytes(&header, sizeof header);
+
+    _last_sync = std::chrono::steady_clock::now();
+    _thread = std::thread([this](){ run(); });
+}
+
+VideoContainerWriter::~VideoContainerWriter()
+{
+    _queue.close();
+    _thread.join();
+
+    free(_batch);
+    close(_index_fd);
+    close(_data_fd);
+}
+
+auto VideoContainerWriter::write_frame(const VideoFramePtr &frame) -> void
+{
+    VideoFramePtr stored = frame;
+
+    if (frame->compression == VideoFrame::Compression::NONE)
+    {
+        if (memcmp(&frame->format, &_encoder_format, sizeof _encoder_format) != 0)
+        {
+            _encoder.set_frame_format(frame->format);
+            _encoder_format = frame->format;
+        }
+
+        stored = _encoder.process_frame(frame);
+    }
+
+    _queue.push(std::move(stored));
+}
+
+auto VideoContainerWriter::process_frame(const std::shared_ptr<VideoFrame> &frame) -> std::shared_ptr<VideoFrame>
+{
+    write_frame(frame);
+
+    return frame;
+}
+
+auto VideoContainerWriter::queue_depth() const -> size_t
+{
+    return _queue.size();
+}
+
+auto VideoContainerWriter::frames_written() const -> uint64_t
+{
+    return _frames_written.load(std::memory_order_relaxed);
+}
+
+auto VideoContainerWriter::bytes_written() const -> uint64_t
+{
+    return _bytes_written.load(std::memory_order_relaxed);
+}
+
+auto VideoContainerWriter::dropped_frames() const -> uint64_t
+{
+    return _queue.dropped() + _write_errors.load(std::memory_order_relaxed);
+}
+
+auto VideoContainerWriter::dump_stats(FILE *fp) const -> void
+{
+    fprintf(fp, "recorder: queue %zu, written %" PRIu64 " frames %" PRIu64 " bytes, dropped %" PRIu64 "\n",
+            queue_depth(), frames_written(), bytes_written(), dropped_frames());
+}
+
+auto VideoContainerWriter::run() -> void
+{
+    configure_current_thread("container-io");
+
+    VideoFramePtr frame;
+
+    while (_queue.pop(frame))
+    {
+        append(*frame);
+        frame = nullptr;
+
+        // Under load the queue keeps filling and batches grow up to
+        // batch_size, an idle queue writes out what there is
+        if (_batch_fill >= _config.batch_size || _queue.empty())
+            flush();
+
+        if (auto now = std::chrono::steady_clock::now(); _config.sync_interval.count() && now - _last_sync >= _config.sync_interval)
+        {
+            fdatasync(_data_fd);
+            fdatasync(_index_fd);
+            _last_sync = now;
+        }
+    }
+
+    flush();
+
+    // Drops the direct I/O padding and unused preallocated space
+    if (ftruncate(_data_fd, _batch_offset + _batch_fill) == -1)
+        warn("%s", _path.c_str());
+
+    if (_config.sync_interval.count())
+    {
+        fdatasync(_data_fd);
+        fdatasync(_index_fd);
+    }
+}
+
+auto VideoContainerWriter::append(const VideoFrame &frame) -> void
+{
+    const auto &metadata = frame.metadata;
+    const size_t record_size = sizeof(RecordHeader) + frame.buffer.size();
+
+    if (_batch_fill + record_size > _batch_capacity)
+    {
+        flush();
+        reserve(_batch_fill + record_size);
+    }
+
+    uint64_t timestamp = metadata.capture_time_ns;
+
+    if (!timestamp)
+        timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    IndexEntry entry{};
+    entry.offset = _batch_offset + _batch_fill + sizeof(RecordHeader);
+
+    RecordHeader &header = entry.header;
+    header.magic = record_magic;
+    header.size = frame.buffer.size();
+    header.sequence = metadata.sequence;
+    header.timestamp_ns = timestamp;
+    header.format = frame.format;
+    header.compression = (uint16_t)frame.compression;
+    header.telemetry_rows = metadata.telemetry_rows;
+    header.telemetry_offset = metadata.telemetry_offset;
+    header.telemetry_size = metadata.telemetry_size;
+
+    append_bytes(&header, sizeof header);
+    append_bytes(frame.buffer.data(), frame.buffer.size());
+
+    _pending.push_back(entry);
+}
+
+auto VideoContainerWriter::append_bytes(const void *data, size_t size) -> void
+{
+    memcpy(_batch + _batch_fill, data, size);
+    _batch_fill += size;
+}
+
+// Grows the batch buffer, keeping its contents
+auto VideoContainerWriter::reserve(size_t size) -> void
+{
+    if (size <= _batch_capacity)
+        return;
+
+    size_t capacity = align_up(size, io_alignment);
+    auto *batch = (uint8_t*)aligned_alloc(io_alignment, capacity);
+
+    if (!batch)
+        err(1, "aligned_alloc");
+
+    if (_batch_fill)
+        memcpy(batch, _batch, _batch_fill);
+
+    free(_batch);
+    _batch = batch;
+    _batch_capacity = capacity;
+}
+
+auto VideoContainerWriter::flush() -> void
+{
+    if (_batch_fill == _batch_written)
+        return;
+
+    size_t write_size = _batch_fill;
+
+    if (_config.direct_io)
+    {
+        write_size = align_up(_batch_fill, io_alignment);
+        reserve(write_size);
+        memset(_batch + _batch_fill, 0, write_size - _batch_fill);
+    }
+
+    preallocate(_batch_offset + write_size);
+
+    if (!pwrite_all(_data_fd, _batch, write_size, _batch_offset))
+    {
+        warn("%s", _path.c_str());
+
+        _write_errors.fetch_add(_pending.size(), std::memory_order_relaxed);
+        _pending.clear();
+        _batch_fill = _batch_written;
+
+        return;
+    }
+
+    _bytes_written.fetch_add(_batch_fill - _batch_written, std::memory_order_relaxed);
+
+    // Only now that their records are out, the index can never point past
+    // the data. Entries go to a tracked offset and a partial write is cut
+    // back off, so a failure never leaves a torn entry that would shift
+    // every later one.
+    size_t index_size = _pending.size() * sizeof(IndexEntry);
+
+    if (pwrite_all(_index_fd, (const uint8_t*)_pending.data(), index_size, _index_offset))
+    {
+        _index_offset += index_size;
+        _frames_written.fetch_add(_pending.size(), std::memory_order_relaxed);
+    }
+    else
+    {
+        warn("%s", container_index_path(_path).c_str());
+
+        if (ftruncate(_index_fd, _index_offset) == -1)
+            warn("%s: ftruncate", container_index_path(_path).c_str());
+
+        _write_errors.fetch_add(_pending.size(), std::memory_order_relaxed);
+    }
+
+    _pending.clear();
+
+    size_t keep = _config.direct_io ? _batch_fill % io_alignment : 0;
+    size_t done = _batch_fill - keep;
+
+    memmove(_batch, _batch + done, keep);
+    _batch_offset += done;
+    _batch_fill = keep;
+    _batch_written = keep;
+}
+
+auto VideoContainerWriter::preallocate(uint64_t end) -> void
+{
+    if (!_config.preallocate || end <= _allocated_end)
+        return;
+
+    uint64_t size = std::max<uint64_t>(_config.preallocate, end - _allocated_end);
+
+    // KEEP_SIZE so readers of a file still being written only see records
+    if (int ret = fallocate(_data_fd, FALLOC_FL_KEEP_SIZE, _allocated_end, size); ret == -1)
+    {
+        if (errno == EOPNOTSUPP)
+            _config.preallocate = 0;
+        else
+            warn("%s: fallocate", _path.c_str());
+
+        return;
+    }
+
+    _allocated_end += size;
+}
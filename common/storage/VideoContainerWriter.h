@@ -0,0 +1,97 @@
+#pragma once
+
+#include "VideoFrame.h"
+#include "compression/JpegLs.h"
+#include "FramePipeline.h"
+#include "FrameQueue.h"
+#include "storage/VideoContainer.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ContainerWriterConfig
+{
+    // Frames waiting for the I/O thread, further frames are dropped unless
+    // the caller should rather wait, e.g. when converting offline
+    size_t queue_size{64};
+    Backpressure backpressure{Backpressure::DROP_NEWEST};
+
+    // Records are gathered and written in batches of up to this size
+    size_t batch_size{4 << 20};
+
+    // Bypass the page cache, writes are then padded to io_alignment
+    bool direct_io{false};
+
+    // Disk space reserved ahead of the write position, 0 disables
+    size_t preallocate{64 << 20};
+
+    // fdatasync period, 0 leaves it to the kernel
+    std::chrono::milliseconds sync_interval{1000};
+};
+
+// Appends frames to a container file, see VideoContainer.h. Uncompressed
+// frames are JPEG-LS encoded, compressed ones are stored as they are.
+//
+// Encoding happens on the caller's thread, the records are handed to an I/O
+// thread through a bounded queue so a slow disk never stalls the caller.
+class VideoContainerWriter : public FramePipeline<VideoFrame>::IComponent
+{
+public:
+    static constexpr size_t io_alignment = 4096;
+
+    VideoContainerWriter(const std::string &path, const ContainerWriterConfig &config = {});
+    ~VideoContainerWriter();
+
+    VideoContainerWriter(const VideoContainerWriter&) = delete;
+    VideoContainerWriter& operator=(const VideoContainerWriter&) = delete;
+
+    auto write_frame(const VideoFramePtr &frame) -> void;
+    auto process_frame(const std::shared_ptr<VideoFrame> &frame) -> std::shared_ptr<VideoFrame> override;
+
+    auto queue_depth() const -> size_t;
+    auto frames_written() const -> uint64_t;
+    auto bytes_written() const -> uint64_t;
+
+    // Frames the queue had no room for, plus frames lost to write errors
+    auto dropped_frames() const -> uint64_t;
+
+    auto dump_stats(FILE *fp) const -> void;
+
+private:
+    std::string _path;
+    ContainerWriterConfig _config;
+    int _data_fd;
+    int _index_fd;
+
+    JpegLsEncoder _encoder;
+    VideoFrame::Format _encoder_format{};
+
+    FrameQueue<VideoFramePtr> _queue;
+    std::thread _thread;
+
+    std::atomic<uint64_t> _frames_written{0};
+    std::atomic<uint64_t> _bytes_written{0};
+    std::atomic<uint64_t> _write_errors{0};
+
+    // Owned by the I/O thread. The batch starts at file offset
+    // _batch_offset, with direct I/O its first _batch_written bytes are the
+    // unaligned tail of the previous write, rewritten along with the next.
+    uint8_t *_batch{nullptr};
+    size_t _batch_capacity{0};
+    size_t _batch_fill{0};
+    size_t _batch_written{0};
+    uint64_t _batch_offset{0};
+    uint64_t _allocated_end{0};
+    uint64_t _index_offset{0}; // end of the last whole entry written
+    std::vector<IndexEntry> _pending;
+    std::chrono::steady_clock::time_point _last_sync;
+
+    auto run() -> void;
+    auto append(const VideoFrame &frame) -> void;
+    auto append_bytes(const void *data, size_t size) -> void;
+    auto reserve(size_t size) -> void;
+    auto flush() -> void;
+    auto preallocate(uint64_t end) -> void;
+};
@@ -9,7 +9,8 @@ VideoSequenceReader::VideoSequenceReader(const std::string &path):
 {
     for (const auto &ent : std::filesystem::directory_iterator(path))
     {
-        _files.push_back(ent.path());
+        if (!ent.path().has_extension())
+            _files.push_back(ent.path());
     }
 
     std::sort(_files.begin(), _files.end(), [](auto &lhs, auto &rhs){
@@ -17,6 +18,16 @@ VideoSequenceReader::VideoSequenceReader(const std::string &path):
     });
 }
 
+auto VideoSequenceReader::num_frames() const -> size_t
+{
+    return _files.size();
+}
+
+auto VideoSequenceReader::seek(size_t idx) -> void
+{
+    _read_idx = std::min(idx, _files.size());
+}
+
 auto VideoSequenceReader::rewind() -> void
 {
 	_read_idx = 0;
@@ -27,10 +38,34 @@ auto VideoSequenceReader::read_frame() -> VideoFramePtr
     if (_read_idx >= _files.size())
         return nullptr;
 
-    auto frame = std::make_shared<VideoFrame>();
+    return read_frame(_read_idx++);
+}
+
+auto VideoSequenceReader::read_frame(size_t idx, FramePool *pool) const -> VideoFramePtr
+{
+    auto frame = read_stored_frame(idx, pool);
+
+    if (!frame)
+        return nullptr;
+
+    const auto &metadata = frame->metadata;
+    size_t codestream_size = metadata.telemetry_size ? metadata.telemetry_offset : frame->buffer.size();
+
+    auto ret = JpegLsDecoder().decode(frame->buffer.data(), codestream_size, metadata.telemetry_size, pool);
+    ret->inherit_metadata(*frame);
+
+    return ret;
+}
+
+auto VideoSequenceReader::read_stored_frame(size_t idx, FramePool *pool) const -> VideoFramePtr
+{
+    if (idx >= _files.size())
+        return nullptr;
+
+    auto frame = acquire_frame(pool);
     frame->compression = VideoFrame::Compression::JPEG_LS;
 
-    const auto file_path = _files[_read_idx++];
+    const auto &file_path = _files[idx];
 
     size_t file_size = std::filesystem::file_size(file_path);
     frame->buffer.resize(file_size);
@@ -38,6 +73,24 @@ auto VideoSequenceReader::read_frame() -> VideoFramePtr
     std::ifstream fp(file_path, std::ios::binary);
     fp.read((char*)frame->buffer.data(), file_size);
 
-    return _decoder.process_frame(frame);
+    frame->format = JpegLsDecoder::frame_format(frame->buffer.data(), frame->buffer.size());
+
+    // Behind the codestream, as the encoder leaves it
+    if (std::ifstream telemetry_fp(sequence_telemetry_path(file_path), std::ios::binary); telemetry_fp)
+    {
+        auto &metadata = frame->metadata;
+        uint16_t rows;
+
+        if (telemetry_fp.read((char*)&rows, sizeof rows))
+        {
+            frame->buffer.insert(frame->buffer.end(), std::istreambuf_iterator<char>(telemetry_fp), std::istreambuf_iterator<char>());
+
+            metadata.telemetry_rows = rows;
+            metadata.telemetry_offset = file_size;
+            metadata.telemetry_size = frame->buffer.size() - file_size;
+        }
+    }
+
+    return frame;
 }
 
@@ -2,20 +2,33 @@
 #include "VideoFrame.h"
 #include "compression/JpegLs.h"
 #include "FramePipeline.h"
+#include "storage/IVideoReader.h"
 #include <filesystem>
 #include <vector>
 #include <string>
 
-class VideoSequenceReader
+// Telemetry split off frame n is kept raw next to it, in n.tel: the number
+// of telemetry rows as a host order uint16_t, then the telemetry bytes
+inline auto sequence_telemetry_path(const std::filesystem::path &frame_path) -> std::filesystem::path
+{
+    auto ret = frame_path;
+
+    return ret += ".tel";
+}
+
+class VideoSequenceReader : public IVideoReader
 {
 public:
     VideoSequenceReader(const std::string &path);
-	auto rewind() -> void;
-    auto read_frame() -> VideoFramePtr;
+    auto num_frames() const -> size_t override;
+    auto seek(size_t idx) -> void override;
+	auto rewind() -> void override;
+    auto read_frame() -> VideoFramePtr override;
+    auto read_frame(size_t idx, FramePool *pool = nullptr) const -> VideoFramePtr override;
+    auto read_stored_frame(size_t idx, FramePool *pool = nullptr) const -> VideoFramePtr override;
 
 private:
     std::string _path;
     std::vector<std::filesystem::path> _files;
     size_t _read_idx;
-    JpegLsDecoder _decoder;
 };
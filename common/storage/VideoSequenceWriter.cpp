@@ -1,12 +1,13 @@
 #include "VideoSequenceWriter.h"
+#include "VideoSequenceReader.h"
 #include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 
 VideoSequenceWriter::VideoSequenceWriter(const std::string &path):
     _path(path),
-    _write_idx(0),
-    _initialized(false)
+    _write_idx(0)
 {
     std::error_code err; // ignored
     std::filesystem::create_directory(_path, err);
@@ -14,18 +15,32 @@ VideoSequenceWriter::VideoSequenceWriter(const std::string &path):
 
 auto VideoSequenceWriter::write_frame(const VideoFramePtr& frame) -> void
 {
-    if (!_initialized)
+    VideoFramePtr compressed_frame = frame;
+
+    if (frame->compression != VideoFrame::Compression::JPEG_LS)
     {
-        _encoder.set_frame_format(frame->format);
-        _initialized = true;
-    }
+        if (memcmp(&frame->format, &_encoder_format, sizeof _encoder_format) != 0)
+        {
+            _encoder.set_frame_format(frame->format);
+            _encoder_format = frame->format;
+        }
 
-    const auto compressed_frame = _encoder.process_frame(frame);
+        compressed_frame = _encoder.process_frame(frame);
+    }
 
+    const auto &metadata = compressed_frame->metadata;
+    const size_t codestream_size = metadata.telemetry_size ? metadata.telemetry_offset : compressed_frame->buffer.size();
     const auto file_path = _path / std::to_string(_write_idx++);
 
     std::ofstream fp(file_path, std::ios::binary);
-    fp.write((char*)compressed_frame->buffer.data(), compressed_frame->buffer.size());
+    fp.write((char*)compressed_frame->buffer.data(), codestream_size);
+
+    if (!metadata.telemetry_size)
+        return;
+
+    std::ofstream telemetry_fp(sequence_telemetry_path(file_path), std::ios::binary);
+    telemetry_fp.write((char*)&metadata.telemetry_rows, sizeof metadata.telemetry_rows);
+    telemetry_fp.write((char*)compressed_frame->telemetry(), metadata.telemetry_size);
 }
 
 auto VideoSequenceWriter::process_frame(const std::shared_ptr<VideoFrame>& frame) -> std::shared_ptr<VideoFrame>
@@ -34,4 +49,3 @@ auto VideoSequenceWriter::process_frame(const std::shared_ptr<VideoFrame>& frame
 
     return frame;
 }
-
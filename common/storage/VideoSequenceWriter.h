@@ -6,6 +6,9 @@
 #include <vector>
 #include <string>
 
+// One JPEG-LS file per frame. JPEG-LS frames are stored as received,
+// uncompressed ones are encoded. Split telemetry goes raw into a file next to
+// the frame's, see sequence_telemetry_path().
 class VideoSequenceWriter : public FramePipeline<VideoFrame>::IComponent
 {
 public:
@@ -16,6 +19,6 @@ public:
 private:
     std::filesystem::path _path;
     size_t _write_idx;
-    bool _initialized;
     JpegLsEncoder _encoder;
+    VideoFrame::Format _encoder_format{};
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "VideoFrame.h"
+#include "transport/Protocol.h"
 #include <memory>
 
 class IVideoRx
@@ -8,7 +9,7 @@ class IVideoRx
 public:
     virtual auto connect() -> void = 0;
     virtual auto get_frame_format() -> VideoFrame::Format = 0;
-    virtual auto send_control_message() -> void = 0;
+    virtual auto send_control_message(const ControlMessage &msg) -> void = 0;
     virtual auto recv_frame() -> VideoFramePtr = 0;
 };
 
@@ -2,20 +2,45 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 #include "VideoFrame.h"
+#include "transport/Protocol.h"
 
 class IVideoTx
 {
 public:
-    using ControlMessageHandler = std::function<void()>;
+    using ControlMessageHandler = std::function<void(const ControlMessage&)>;
 
-    virtual auto set_frame_format(VideoFrame::Format format) -> void = 0;
+    // Layers are the same stream at different resolutions, 0 being the full
+    // one. Streams are independent sources, numbered from 0 without gaps.
+    // Every layer that frames are sent on needs a format.
+    virtual auto set_frame_format(VideoFrame::Format format, uint16_t layer = 0, uint16_t stream = 0) -> void = 0;
 
     virtual auto handle_control_message(const ControlMessageHandler &handler) -> void = 0;
     virtual auto await_connection() -> void = 0;
     virtual auto poll_client() -> void = 0;
 
-    virtual auto send_frame(const VideoFramePtr &frame) -> void = 0;
+    // Lets the caller skip producing layers nobody watches
+    virtual auto has_subscribers(uint16_t layer, uint16_t stream = 0) -> bool = 0;
+
+    // What clients of a layer want, every distinct subscription needs its own
+    // send_frame call with a frame of that compression
+    struct Subscription
+    {
+        VideoFrame::Rect crop; // zero width for the full frame
+        VideoFrame::Compression compression;
+
+        auto operator==(const Subscription &other) const -> bool
+        {
+            return crop == other.crop && compression == other.compression;
+        }
+    };
+
+    virtual auto subscriptions(uint16_t layer, uint16_t stream = 0) -> std::vector<Subscription> = 0;
+
+    // May be called for different streams from different threads at once
+    virtual auto send_frame(const VideoFramePtr &frame, uint16_t layer = 0, const VideoFrame::Rect &crop = {},
+            uint16_t stream = 0) -> void = 0;
 };
 
 using IVideoTxPtr = std::unique_ptr<IVideoTx>;
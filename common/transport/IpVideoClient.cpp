@@ -1,5 +1,7 @@
 #include "transport/IpVideoClient.h"
 #include "VideoFrame.h"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <cstdio>
 #include <err.h>
@@ -11,8 +13,9 @@ static int connect_(int fd, const struct sockaddr *addr, socklen_t len)
     return connect(fd, addr, len);
 }
 
-IpVideoClient::IpVideoClient(const std::string &connect_addr, int connect_port):
-    _frame_format{nullptr}, _last_frame_id{0}, _expected_num_fragments{0}
+IpVideoClient::IpVideoClient(const std::string &connect_addr, int connect_port, uint16_t layer,
+        VideoFrame::Compression compression, uint16_t stream):
+    _layer{layer}, _compression{compression}, _stream{stream}, _num_streams{0}, _last_frame_id{0}, _expected_num_fragments{0}
 {
     _connect_sa.sin_family = AF_INET;
     _connect_sa.sin_addr.s_addr = inet_addr(connect_addr.c_str());
@@ -34,48 +37,90 @@ auto IpVideoClient::connect() -> void
     if (connect_(_stream_fd, (sockaddr*)&_connect_sa, sizeof _connect_sa) == -1)
         err(1, "connect");
 
-    uint16_t recv_port = htons(ntohs(_connect_sa.sin_port) + 1);
-
+    // Any free port, several clients may run on the same host
     sockaddr_in dgram_sa;
     dgram_sa.sin_family = AF_INET;
     dgram_sa.sin_addr.s_addr = inet_addr("0.0.0.0");
-    dgram_sa.sin_port = recv_port;
+    dgram_sa.sin_port = 0;
 
     if (bind(_dgram_fd, (sockaddr*)&dgram_sa, sizeof dgram_sa) == -1)
         err(1, "bind");
 
-    if (send(_stream_fd, &recv_port, sizeof recv_port, 0) != sizeof recv_port)
+    socklen_t socklen = sizeof dgram_sa;
+
+    if (getsockname(_dgram_fd, (sockaddr*)&dgram_sa, &socklen) == -1)
+        err(1, "getsockname");
+
+    ClientHello hello{dgram_sa.sin_port, htons(_layer), htons((uint16_t)_compression), htons(_stream)};
+
+    if (send(_stream_fd, &hello, sizeof hello, 0) != sizeof hello)
         err(1, "send");
 
-    VideoFrame::Format frame_format;
+    ServerHello reply;
 
-    if (recv(_stream_fd, &frame_format, sizeof frame_format, MSG_WAITALL) != sizeof frame_format)
+    if (recv(_stream_fd, &reply, sizeof reply, MSG_WAITALL) != sizeof reply)
         err(1, "recv");
 
-    frame_format.width = ntohs(frame_format.width);
-    frame_format.height = ntohs(frame_format.height);
-    frame_format.num_components = ntohs(frame_format.num_components);
-    frame_format.bits_per_pixel = ntohs(frame_format.bits_per_pixel);
+    _layer_formats.clear();
+
+    for (size_t i = 0; i < std::min<uint16_t>(ntohs(reply.num_layers), max_layers); i++)
+    {
+        _layer_formats.push_back(ntoh_format(reply.formats[i]));
+    }
+
+    _layer = ntohs(reply.layer);
+    _compression = (VideoFrame::Compression)ntohs(reply.compression);
+    _stream = ntohs(reply.stream);
+    _num_streams = ntohs(reply.num_streams);
+}
+
+auto IpVideoClient::send_control_message(const ControlMessage &msg) -> void
+{
+    if (send(_stream_fd, &msg, sizeof msg, 0) != sizeof msg)
+        err(1, "send");
+}
+
+auto IpVideoClient::select_layer(uint16_t layer) -> void
+{
+    if (_layer_formats.empty())
+        errx(1, "client not connected");
+
+    _layer = std::min<uint16_t>(layer, _layer_formats.size() - 1);
 
-    _frame_format = std::make_unique<VideoFrame::Format>(frame_format);
+    send_control_message(make_select_layer_message(_layer));
 }
 
-auto IpVideoClient::send_control_message() -> void
+auto IpVideoClient::set_crop(const VideoFrame::Rect &crop) -> void
 {
-    // Unimplemented
+    send_control_message(make_set_crop_message(crop));
+}
+
+auto IpVideoClient::num_layers() const -> uint16_t
+{
+    return _layer_formats.size();
+}
+
+auto IpVideoClient::stream() const -> uint16_t
+{
+    return _stream;
+}
+
+auto IpVideoClient::num_streams() const -> uint16_t
+{
+    return _num_streams;
 }
 
 auto IpVideoClient::recv_frame() -> VideoFramePtr
 {
     size_t total_size = 0;
-    uint8_t got_num_fragments = 0;
+    uint16_t got_num_fragments = 0;
 
     msghdr msg = {};
     iovec io[2];
 
-    uint32_t frag_hdr[4];
+    FragmentHeader frag_hdr;
 
-    io[0].iov_base = frag_hdr;
+    io[0].iov_base = &frag_hdr;
     io[0].iov_len = sizeof frag_hdr;
 
     std::array<uint8_t, 65535-2000> tmp;
@@ -101,10 +146,14 @@ auto IpVideoClient::recv_frame() -> VideoFramePtr
 		}
 		while (!recv_size);
 
-        uint32_t frame_id = frag_hdr[0];
-        uint32_t frag_id = frag_hdr[1];
-        uint32_t expect_num_frag = frag_hdr[2];
-        uint32_t frag_offset = frag_hdr[3];
+        // Frame ids are shared by all streams
+        if (frag_hdr.stream != _stream)
+            continue;
+
+        uint32_t frame_id = frag_hdr.frame_id;
+        uint32_t frag_id = frag_hdr.frag_id;
+        uint32_t expect_num_frag = frag_hdr.num_frags;
+        uint32_t frag_offset = frag_hdr.offset;
 
         printf("- frame_id = %d\n", frame_id);
         printf("- frag_id = %d\n", frag_id);
@@ -127,6 +176,10 @@ auto IpVideoClient::recv_frame() -> VideoFramePtr
         }
 
         size_t payload_size = (recv_size - sizeof frag_hdr);
+
+        if (frag_offset + payload_size > _frame_buffer.size())
+            continue;
+
         total_size += payload_size;
 
         memcpy(_frame_buffer.data() + frag_offset, tmp.data(), payload_size);
@@ -135,19 +188,47 @@ auto IpVideoClient::recv_frame() -> VideoFramePtr
 
 	printf("[*] collected VideoFrame\n");
 
+    if (total_size < sizeof(FrameHeader))
+        return recv_frame();
+
+    FrameHeader frame_hdr;
+    memcpy(&frame_hdr, _frame_buffer.data(), sizeof frame_hdr);
+
     auto video_frame = std::make_shared<VideoFrame>();
-    video_frame->buffer.resize(total_size);
+    video_frame->buffer.assign(_frame_buffer.data() + sizeof frame_hdr, _frame_buffer.data() + total_size);
+
+    auto &metadata = video_frame->metadata;
+    metadata.sequence = frame_hdr.sequence;
+    metadata.capture_time_ns = frame_hdr.capture_time_ns;
+    metadata.send_time_ns = frame_hdr.send_time_ns;
+    metadata.recv_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    metadata.has_stats = frame_hdr.has_stats;
+    metadata.min = frame_hdr.min;
+    metadata.max = frame_hdr.max;
+    metadata.mean = frame_hdr.mean;
+
+    if ((size_t)frame_hdr.telemetry_offset + frame_hdr.telemetry_size <= video_frame->buffer.size())
+    {
+        metadata.telemetry_rows = frame_hdr.telemetry_rows;
+        metadata.telemetry_offset = frame_hdr.telemetry_offset;
+        metadata.telemetry_size = frame_hdr.telemetry_size;
+    }
+
+    video_frame->format = frame_hdr.format;
+    video_frame->compression = (VideoFrame::Compression)frame_hdr.compression;
 
-    memcpy(video_frame->buffer.data(), _frame_buffer.data(), total_size);
+    video_frame->origin_x = frag_hdr.origin_x;
+    video_frame->origin_y = frag_hdr.origin_y;
 
     return video_frame;
 }
 
 auto IpVideoClient::get_frame_format() -> VideoFrame::Format
 {
-    if (!_frame_format)
+    if (_layer_formats.empty())
         errx(1, "client not connected");
 
-    return *_frame_format.get();
+    return _layer_formats[_layer];
 }
 
@@ -7,23 +7,43 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 #include <sys/socket.h>
 
 class IpVideoClient : public IVideoRx
 {
 public:
-    IpVideoClient(const std::string &connect_addr, int connect_port);
+    // compression is JPEG_LS, or PACKED to skip the codec on fast links
+    IpVideoClient(const std::string &connect_addr, int connect_port, uint16_t layer = 0,
+            VideoFrame::Compression compression = VideoFrame::Compression::JPEG_LS, uint16_t stream = 0);
 
     auto connect() -> void override;
     auto get_frame_format() -> VideoFrame::Format override;
-    auto send_control_message() -> void override;
+    auto send_control_message(const ControlMessage &msg) -> void override;
     auto recv_frame() -> VideoFramePtr override;
 
+    // Switches to another resolution layer, frames of the old one may still
+    // arrive for a moment
+    auto select_layer(uint16_t layer) -> void;
+    auto num_layers() const -> uint16_t;
+
+    // Stream picked at connect time, and how many the server has
+    auto stream() const -> uint16_t;
+    auto num_streams() const -> uint16_t;
+
+    // Only this part of the layer is sent from now on, a zero width goes
+    // back to the full frame
+    auto set_crop(const VideoFrame::Rect &crop) -> void;
+
 private:
-    std::unique_ptr<VideoFrame::Format> _frame_format;
+    std::vector<VideoFrame::Format> _layer_formats;
+    uint16_t _layer;
+    VideoFrame::Compression _compression;
+    uint16_t _stream;
+    uint16_t _num_streams;
     std::array<uint8_t, 1920*1080*4> _frame_buffer;
     uint32_t _last_frame_id;
-    uint8_t _expected_num_fragments;
+    uint16_t _expected_num_fragments;
 
     sockaddr_in _connect_sa;
 
@@ -1,11 +1,20 @@
 #include "transport/IpVideoServer.h"
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <err.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static auto now_ns() -> uint64_t
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
 
 IpVideoServer::IpVideoServer(const std::string &listen_addr, int listen_port):
-    _frame_format{nullptr}, _control_message_handler{nullptr}, _frame_id{0}
+    _control_message_handler{nullptr}, _listening{false}, _frame_id{0}
 {
     _listen_sa.sin_family = AF_INET;
     _listen_sa.sin_addr.s_addr = inet_addr(listen_addr.c_str());
@@ -22,13 +31,23 @@ IpVideoServer::IpVideoServer(const std::string &listen_addr, int listen_port):
         err(1, "socket");
 }
 
-auto IpVideoServer::set_frame_format(VideoFrame::Format format) -> void
+auto IpVideoServer::set_frame_format(VideoFrame::Format format, uint16_t layer, uint16_t stream) -> void
 {
-    _frame_format = std::make_unique<VideoFrame::Format>(format);
-    _frame_format->width = htons(_frame_format->width);
-    _frame_format->height = htons(_frame_format->height);
-    _frame_format->num_components = htons(_frame_format->num_components);
-    _frame_format->bits_per_pixel = htons(_frame_format->bits_per_pixel);
+    if (layer >= max_layers)
+        errx(1, "layer %d out of range", layer);
+
+    if (stream >= max_streams)
+        errx(1, "stream %d out of range", stream);
+
+    if (stream >= _stream_formats.size())
+        _stream_formats.resize(stream + 1);
+
+    auto &layer_formats = _stream_formats[stream];
+
+    if (layer >= layer_formats.size())
+        layer_formats.resize(layer + 1);
+
+    layer_formats[layer] = format;
 }
 
 auto IpVideoServer::handle_control_message(const ControlMessageHandler &handler) -> void
@@ -36,8 +55,11 @@ auto IpVideoServer::handle_control_message(const ControlMessageHandler &handler)
     _control_message_handler = std::make_unique<ControlMessageHandler>(handler);
 }
 
-auto IpVideoServer::await_connection() -> void
+auto IpVideoServer::start_listening() -> void
 {
+    if (_listening)
+        return;
+
     int ret;
     int reuse_addr = 1;
 
@@ -46,83 +68,303 @@ auto IpVideoServer::await_connection() -> void
     if (ret = bind(_listen_fd, (sockaddr*)&_listen_sa, sizeof _listen_sa); ret == -1)
         err(1, "bind");
 
-    if (listen(_listen_fd, 1) == -1)
+    if (listen(_listen_fd, 16) == -1)
         err(1, "listen");
 
-    socklen_t socklen = sizeof _client_sa;
+    _listening = true;
+}
+
+auto IpVideoServer::await_connection() -> void
+{
+    start_listening();
 
-    if (_stream_fd = accept(_listen_fd, (sockaddr*)&_client_sa, &socklen); _stream_fd == -1)
-        err(1, "accept");
+    while (1)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_clients_mtx);
+
+            if (!_clients.empty())
+                break;
+        }
+
+        poll_client();
+    }
+}
+
+auto IpVideoServer::poll_client() -> void
+{
+    start_listening();
+
+    std::vector<pollfd> fds{{_listen_fd, POLLIN, 0}};
+
+    {
+        std::lock_guard<std::mutex> lock(_clients_mtx);
+
+        for (const auto &client : _clients)
+        {
+            fds.push_back({client.stream_fd, POLLIN, 0});
+        }
+    }
 
-    uint16_t reply_port;
-    recv(_stream_fd, &reply_port, sizeof reply_port, MSG_WAITALL);
+    if (poll(fds.data(), fds.size(), 100) <= 0)
+        return;
 
-    _client_sa.sin_port = reply_port;
+    if (fds[0].revents & POLLIN)
+        accept_client();
 
-    if (!_frame_format)
+    for (size_t i = 1; i < fds.size(); i++)
+    {
+        if (!fds[i].revents || handle_client(fds[i].fd))
+            continue;
+
+        printf("[.] client disconnected\n");
+
+        std::lock_guard<std::mutex> lock(_clients_mtx);
+
+        _clients.erase(std::remove_if(_clients.begin(), _clients.end(),
+                    [&](const Client &c){ return c.stream_fd == fds[i].fd; }), _clients.end());
+        close(fds[i].fd);
+    }
+}
+
+auto IpVideoServer::accept_client() -> void
+{
+    if (_stream_formats.empty())
         errx(1, "no frame format set");
 
-    send(_stream_fd, _frame_format.get(), sizeof(VideoFrame::Format), 0);
+    Client client;
+    socklen_t socklen = sizeof client.dgram_sa;
+
+    if (client.stream_fd = accept(_listen_fd, (sockaddr*)&client.dgram_sa, &socklen); client.stream_fd == -1)
+    {
+        warn("accept");
+        return;
+    }
+
+    // A client that never finishes the handshake, or stops halfway through a
+    // control message, must not stall the others. The timeout stays set for
+    // the lifetime of the connection.
+    timeval timeout{1, 0};
+    setsockopt(client.stream_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    ClientHello hello;
+
+    if (recv(client.stream_fd, &hello, sizeof hello, MSG_WAITALL) != sizeof hello)
+    {
+        warnx("client handshake failed");
+        close(client.stream_fd);
+        return;
+    }
+
+    client.dgram_sa.sin_port = hello.reply_port;
+    client.stream = std::min<uint16_t>(ntohs(hello.stream), _stream_formats.size() - 1);
+
+    const auto &layer_formats = _stream_formats[client.stream];
+
+    if (layer_formats.empty())
+    {
+        warnx("stream %d has no frame format", client.stream);
+        close(client.stream_fd);
+        return;
+    }
+
+    client.layer = std::min<uint16_t>(ntohs(hello.layer), layer_formats.size() - 1);
+    client.crop = {};
+    client.compression = (VideoFrame::Compression)ntohs(hello.compression);
+
+    if (client.compression != VideoFrame::Compression::PACKED)
+        client.compression = VideoFrame::Compression::JPEG_LS;
+
+    ServerHello reply{};
+    reply.num_layers = htons(layer_formats.size());
+    reply.layer = htons(client.layer);
+    reply.compression = htons((uint16_t)client.compression);
+    reply.num_streams = htons(_stream_formats.size());
+    reply.stream = htons(client.stream);
+
+    for (size_t i = 0; i < layer_formats.size(); i++)
+    {
+        reply.formats[i] = hton_format(layer_formats[i]);
+    }
+
+    send(client.stream_fd, &reply, sizeof reply, 0);
+
+    printf("[.] client connected (stream %d, layer %d%s)\n", client.stream, client.layer,
+            client.compression == VideoFrame::Compression::PACKED ? ", packed" : "");
+
+    std::lock_guard<std::mutex> lock(_clients_mtx);
+    _clients.push_back(client);
 }
 
-auto IpVideoServer::poll_client() -> void
+// Returns false once the client is gone, or timed out sending a message
+auto IpVideoServer::handle_client(int stream_fd) -> bool
 {
-    char tmp;
-    recv(_stream_fd, &tmp, sizeof tmp, MSG_PEEK);
+    ControlMessage msg;
+
+    if (recv(stream_fd, &msg, sizeof msg, MSG_WAITALL) != sizeof msg)
+        return false;
+
+    switch ((ControlMessage::Type)ntohs(msg.type))
+    {
+    case ControlMessage::Type::SELECT_LAYER:
+    {
+        std::lock_guard<std::mutex> lock(_clients_mtx);
+
+        for (auto &client : _clients)
+        {
+            if (client.stream_fd != stream_fd)
+                continue;
+
+            // Crop coordinates are relative to the old layer
+            client.layer = std::min<uint16_t>(ntohs(msg.params[0]), _stream_formats[client.stream].size() - 1);
+            client.crop = {};
+        }
+
+        break;
+    }
+    case ControlMessage::Type::SET_CROP:
+    {
+        VideoFrame::Rect crop{ntohs(msg.params[0]), ntohs(msg.params[1]), ntohs(msg.params[2]), ntohs(msg.params[3])};
+
+        std::lock_guard<std::mutex> lock(_clients_mtx);
+
+        for (auto &client : _clients)
+        {
+            if (client.stream_fd == stream_fd)
+                client.crop = clamp_crop(crop, client.stream, client.layer);
+        }
+
+        break;
+    }
+    default:
+        if (_control_message_handler)
+            (*_control_message_handler)(msg);
+
+        break;
+    }
+
+    return true;
 }
 
-auto IpVideoServer::send_frame(const VideoFramePtr &frame) -> void
+auto IpVideoServer::has_subscribers(uint16_t layer, uint16_t stream) -> bool
+{
+    std::lock_guard<std::mutex> lock(_clients_mtx);
+
+    return std::any_of(_clients.begin(), _clients.end(), [&](const Client &c){ return c.stream == stream && c.layer == layer; });
+}
+
+auto IpVideoServer::clamp_crop(VideoFrame::Rect crop, uint16_t stream, uint16_t layer) const -> VideoFrame::Rect
+{
+    const auto &format = _stream_formats[stream][layer];
+
+    if (crop.x >= format.width || crop.y >= format.height)
+        return {};
+
+    crop.width = std::min<uint16_t>(crop.width, format.width - crop.x);
+    crop.height = std::min<uint16_t>(crop.height, format.height - crop.y);
+
+    if (!crop.width || !crop.height || (crop.width == format.width && crop.height == format.height))
+        return {};
+
+    return crop;
+}
+
+auto IpVideoServer::subscriptions(uint16_t layer, uint16_t stream) -> std::vector<Subscription>
+{
+    std::vector<Subscription> ret;
+
+    std::lock_guard<std::mutex> lock(_clients_mtx);
+
+    for (const auto &client : _clients)
+    {
+        Subscription sub{client.crop, client.compression};
+
+        if (client.stream == stream && client.layer == layer && std::find(ret.begin(), ret.end(), sub) == ret.end())
+            ret.push_back(sub);
+    }
+
+    return ret;
+}
+
+auto IpVideoServer::send_frame(const VideoFramePtr &frame, uint16_t layer, const VideoFrame::Rect &crop, uint16_t stream) -> void
 {
     constexpr size_t max_msg_size = 65535 - 2000;
 
+    std::vector<sockaddr_in> destinations;
+
+    {
+        std::lock_guard<std::mutex> lock(_clients_mtx);
+
+        for (const auto &client : _clients)
+        {
+            if (client.stream == stream && client.layer == layer && client.crop == crop && client.compression == frame->compression)
+                destinations.push_back(client.dgram_sa);
+        }
+    }
+
+    if (destinations.empty())
+        return;
+
+    const uint32_t frame_id = _frame_id++;
+    const auto &metadata = frame->metadata;
+
+    FrameHeader frame_hdr{frame->format, (uint16_t)frame->compression, metadata.sequence, metadata.capture_time_ns, now_ns(),
+        metadata.telemetry_offset, metadata.telemetry_size, metadata.telemetry_rows,
+        metadata.has_stats, metadata.min, metadata.max, metadata.mean};
+
+    // The payload is the frame header followed by the buffer, a fragment
+    // may take its bytes from either or both
+    const std::pair<uint8_t*, size_t> parts[2] = {
+        {(uint8_t*)&frame_hdr, sizeof frame_hdr},
+        {frame->buffer.data(), frame->buffer.size()},
+    };
+
     size_t current_pos = 0;
-    size_t bytes_remaining = frame->buffer.size();
+    size_t bytes_remaining = sizeof frame_hdr + frame->buffer.size();
 
-    uint8_t frag_id = 0;
-    uint8_t num_fragments = (bytes_remaining + max_msg_size) / max_msg_size;
+    uint16_t frag_id = 0;
+    uint16_t num_fragments = (bytes_remaining + max_msg_size - 1) / max_msg_size;
 
-	printf("[.] sending frame = %d\n", _frame_id);
+	printf("[.] sending frame = %d (stream %d, layer %d, %zu clients)\n", frame_id, stream, layer, destinations.size());
 
     while (bytes_remaining)
     {
         msghdr msg = {};
-        iovec io[2];
+        iovec io[3];
 
-        uint32_t frag_hdr[4] = {_frame_id, frag_id++, num_fragments, (uint32_t)current_pos};
+        FragmentHeader frag_hdr{frame_id, frag_id++, num_fragments, (uint32_t)current_pos,
+            layer, frame->origin_x, frame->origin_y, stream};
 
-        io[0].iov_base = frag_hdr;
+        io[0].iov_base = &frag_hdr;
         io[0].iov_len = sizeof frag_hdr;
 
-		printf("- bytes remaining = %zu\n", bytes_remaining);
-
         size_t payload_size = std::min(max_msg_size, bytes_remaining);
+        size_t part_pos = 0;
 
-		printf("- payload size = %zu\n", payload_size);
+        msg.msg_iov = io;
+        msg.msg_iovlen = 1;
 
-        io[1].iov_base = frame->buffer.data() + current_pos;
-        io[1].iov_len = payload_size;
+        for (const auto &[data, size] : parts)
+        {
+            size_t begin = std::max(current_pos, part_pos);
+            size_t end = std::min(current_pos + payload_size, part_pos + size);
 
-		msg.msg_name = &_client_sa;
-        msg.msg_namelen = sizeof _client_sa;
-        msg.msg_iov = io;
-        msg.msg_iovlen = 2;
-        msg.msg_control = 0;
-        msg.msg_controllen = 0;
-        msg.msg_flags = 0;
+            if (begin < end)
+                io[msg.msg_iovlen++] = {data + (begin - part_pos), end - begin};
 
-		ssize_t ret;
+            part_pos += size;
+        }
 
-        if (ret = sendmsg(_dgram_fd, &msg, 0); ret == -1)
+        for (auto &sa : destinations)
         {
-            err(1, "sendmsg");
-        }
+            msg.msg_name = &sa;
+            msg.msg_namelen = sizeof sa;
 
-		printf("[.] sendmsg -> %zd\n", ret);
+            if (sendmsg(_dgram_fd, &msg, 0) == -1)
+                warn("sendmsg");
+        }
 
         current_pos += payload_size;
         bytes_remaining -= payload_size;
     }
-
-    ++_frame_id;
 }
-
@@ -3,34 +3,61 @@
 #include "VideoFrame.h"
 #include "transport/IVideoTx.h"
 #include <arpa/inet.h>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <sys/socket.h>
+#include <vector>
 
+// Serves any number of clients, each subscribed to one resolution layer of
+// one stream.
+// poll_client() accepts new clients and handles their control messages, it
+// may run on a different thread than send_frame().
 class IpVideoServer : public IVideoTx
 {
 public:
     IpVideoServer(const std::string &listen_addr, int listen_port);
 
-    auto set_frame_format(VideoFrame::Format format) -> void override;
+    auto set_frame_format(VideoFrame::Format format, uint16_t layer = 0, uint16_t stream = 0) -> void override;
 
     auto handle_control_message(const ControlMessageHandler &handler) -> void override;
     auto await_connection() -> void override;
     auto poll_client() -> void override;
 
-    auto send_frame(const VideoFramePtr &frame) -> void override;
+    auto has_subscribers(uint16_t layer, uint16_t stream = 0) -> bool override;
+    auto subscriptions(uint16_t layer, uint16_t stream = 0) -> std::vector<Subscription> override;
+    auto send_frame(const VideoFramePtr &frame, uint16_t layer = 0, const VideoFrame::Rect &crop = {},
+            uint16_t stream = 0) -> void override;
 
 private:
-    std::unique_ptr<VideoFrame::Format> _frame_format;
+    struct Client
+    {
+        int stream_fd;
+        sockaddr_in dgram_sa;
+        uint16_t stream;
+        uint16_t layer;
+        VideoFrame::Rect crop;
+        VideoFrame::Compression compression;
+    };
+
+    // Layer formats of every stream
+    std::vector<std::vector<VideoFrame::Format>> _stream_formats;
     std::unique_ptr<ControlMessageHandler> _control_message_handler;
 
     sockaddr_in _listen_sa;
-    sockaddr_in _client_sa;
 
     int _listen_fd;
-    int _stream_fd;
     int _dgram_fd;
+    bool _listening;
 
-    uint32_t _frame_id;
-};
+    std::mutex _clients_mtx;
+    std::vector<Client> _clients;
+
+    std::atomic<uint32_t> _frame_id;
 
+    auto start_listening() -> void;
+    auto accept_client() -> void;
+    auto handle_client(int stream_fd) -> bool;
+    auto clamp_crop(VideoFrame::Rect crop, uint16_t stream, uint16_t layer) const -> VideoFrame::Rect;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "VideoFrame.h"
+#include <arpa/inet.h>
+#include <cstdint>
+
+// Wire structures shared by IpVideoServer and IpVideoClient. Everything sent
+// over the TCP control connection is in network byte order, fragment headers
+// are sent in host order.
+
+constexpr uint16_t max_layers = 4;
+
+// Independent sources served by one server, e.g. one per camera
+constexpr uint16_t max_streams = 8;
+
+// Client -> server right after connecting
+struct ClientHello
+{
+    uint16_t reply_port;  // UDP port frames are sent to
+    uint16_t layer;       // initially subscribed resolution layer
+    uint16_t compression; // VideoFrame::Compression, JPEG_LS or PACKED
+    uint16_t stream;
+};
+
+// Server -> client reply to ClientHello
+struct ServerHello
+{
+    uint16_t num_layers;
+    uint16_t layer;       // layer actually subscribed, clamped to num_layers
+    uint16_t compression; // what the server will send
+    uint16_t num_streams;
+    uint16_t stream;      // stream actually subscribed
+    VideoFrame::Format formats[max_layers]; // of the subscribed stream
+};
+
+// Client -> server at any time after the handshake
+struct ControlMessage
+{
+    enum class Type : uint16_t
+    {
+        SELECT_LAYER = 1, // params[0]: layer
+        SET_CROP,         // params[0..3]: x, y, width, height in layer
+                          // coordinates, zero width for the full frame
+        TRIGGER_RECORDING, // params[0]: stream, see PreEventRecorder
+        CALIBRATE_NUC,     // params[0]: stream, params[1]: reference, see
+                           // NonUniformityCorrection::Reference
+    };
+
+    uint16_t type;
+    uint16_t params[7];
+};
+
+// Prefix of every frame fragment datagram
+struct FragmentHeader
+{
+    uint32_t frame_id;
+    uint16_t frag_id;
+    uint16_t num_frags;
+    uint32_t offset;
+    uint16_t layer;
+    uint16_t origin_x; // crop position, see VideoFrame::origin_x
+    uint16_t origin_y;
+    uint16_t stream;
+};
+
+// Start of every frame payload, the frame buffer follows. Sent in host order
+// like the fragment headers, telemetry offset is relative to the frame
+// buffer.
+struct FrameHeader
+{
+    VideoFrame::Format format;
+    uint16_t compression;
+    uint64_t sequence;
+    uint64_t capture_time_ns;
+    uint64_t send_time_ns;
+    uint32_t telemetry_offset;
+    uint32_t telemetry_size;
+    uint16_t telemetry_rows;
+    uint16_t has_stats;
+    float min;
+    float max;
+    float mean;
+};
+
+inline auto make_select_layer_message(uint16_t layer) -> ControlMessage
+{
+    return {htons((uint16_t)ControlMessage::Type::SELECT_LAYER), {htons(layer)}};
+}
+
+inline auto make_set_crop_message(const VideoFrame::Rect &crop) -> ControlMessage
+{
+    return {htons((uint16_t)ControlMessage::Type::SET_CROP),
+        {htons(crop.x), htons(crop.y), htons(crop.width), htons(crop.height)}};
+}
+
+inline auto make_trigger_recording_message(uint16_t stream) -> ControlMessage
+{
+    return {htons((uint16_t)ControlMessage::Type::TRIGGER_RECORDING), {htons(stream)}};
+}
+
+inline auto make_calibrate_nuc_message(uint16_t stream, uint16_t reference) -> ControlMessage
+{
+    return {htons((uint16_t)ControlMessage::Type::CALIBRATE_NUC), {htons(stream), htons(reference)}};
+}
+
+inline auto hton_format(VideoFrame::Format format) -> VideoFrame::Format
+{
+    format.width = htons(format.width);
+    format.height = htons(format.height);
+    format.num_components = htons(format.num_components);
+    format.bits_per_pixel = htons(format.bits_per_pixel);
+
+    return format;
+}
+
+inline auto ntoh_format(VideoFrame::Format format) -> VideoFrame::Format
+{
+    return hton_format(format);
+}
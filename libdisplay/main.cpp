@@ -1,13 +1,22 @@
 #include "IVideoDisplay.h"
 #include "VideoFrame.h"
-#include "storage/VideoSequenceReader.h"
+#include "storage/PrefetchingVideoReader.h"
 #include <cstdint>
+#include <string>
 #include <unistd.h>
 #include <vector>
 
-int main(void)
+// usage: display [recording] [step], a negative step plays in reverse
+int main(int argc, char **argv)
 {
-    VideoSequenceReader reader("TEST_VIDEO");
+    std::string path = argc > 1 ? argv[1] : "TEST_VIDEO";
+    int step = argc > 2 ? std::stoi(argv[2]) : 1;
+
+    PrefetchingVideoReader reader(open_video_reader(path));
+    reader.set_step(step);
+
+    if (step < 0)
+        reader.seek(reader.num_frames() - 1);
 
     auto disp = create_glfw_video_display(1280, 960);
 
@@ -30,4 +39,3 @@ int main(void)
 
     return 0;
 }
-
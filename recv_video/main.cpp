@@ -1,98 +1,158 @@
 #include "transport/IVideoRx.h"
 #include "transport/IpVideoClient.h"
+#include "compression/BitPack.h"
 #include "compression/JpegLs.h"
+#include "storage/VideoContainerWriter.h"
 #include "storage/VideoSequenceWriter.h"
+#include "processing/Clahe.h"
+#include "processing/HistogramEqualizer.h"
 #include "FramePipeline.h"
+#include "FrameQueue.h"
+#include "StaticFramePipeline.h"
+#include "ThreadConfig.h"
 #include "IVideoDisplay.h"
-#include "opencv2/opencv.hpp"
-#include <cmath>
+#include <csignal>
 #include <cstdio>
-#include <opencv2/core.hpp>
-#include <opencv2/highgui.hpp>
-#include <opencv2/imgproc.hpp>
+#include <cstring>
 #include <sys/stat.h>
 #include <ctime>
 #include <err.h>
+#include <getopt.h>
 #include <memory>
 #include <string>
 
-class HistogramEqualizer : public FramePipeline<VideoFrame>::IComponent
+struct VideoRecieverContext
 {
-public:
-	HistogramEqualizer()
-	{
-	}
+    IVideoRxPtr video_rx;
+    FramePipeline<VideoFrame> rx_pipeline{{4, Backpressure::DROP_OLDEST}};
+    FramePipeline<VideoFrame> *display_branch;
+    int stats_interval{0};
+    std::string stats_path{""};
+    std::string record_path{""};
+    ContainerWriterConfig record_config{};
+    VideoContainerWriter *recorder{nullptr};
+    uint16_t layer{0};
+    uint16_t stream{0};
+    VideoFrame::Rect crop{};
+    VideoFrame::Compression compression{VideoFrame::Compression::JPEG_LS};
+    float clahe_clip_limit{0}; // 0 uses the global HistogramEqualizer
+    int nuc_reference{-1}; // asked of the server once connected
+};
 
-	auto process_frame(const VideoFramePtr &frame) -> VideoFramePtr
-	{
-		cv::Size img_size(frame->format.width, frame->format.height - 4);
-		cv::Mat img(img_size, CV_16UC1, frame->buffer.data());
+// SIGUSR1 asks the server to record an event on our stream
+static volatile sig_atomic_t trigger_requested = 0;
 
-        std::array<uint32_t, 256> hist = {0};
+static void request_trigger(int)
+{
+    trigger_requested = 1;
+}
 
-		for (size_t i = 0; i < img.size[0]*img.size[1]; i++)
-		{
-			uint16_t &v = img.at<uint16_t>(i);
-            hist[v / 256] += 1;
-		}
+// Runs on a single thread, so the display chain is one statically
+// dispatched component. Telemetry stays split off, behind the image rows the
+// display and the equalizer look at.
+template<typename EqualizerT, typename ArgT>
+static auto add_display_chain(FramePipeline<VideoFrame> &branch, ArgT &&equalizer_arg) -> void
+{
+    branch.make_component<StaticFramePipeline<BitUnpacker, JpegLsDecoder, EqualizerT>>(
+            BitUnpacker(), JpegLsDecoder(), std::forward<ArgT>(equalizer_arg));
+}
 
-        uint32_t lo_thresh = 1000, hi_thresh = 200;
-        int lo_bin{-1}, hi_bin{-1};
+VideoRecieverContext create_context(int argc, char **argv)
+{
+    VideoRecieverContext ret;
 
-        for (size_t i = 0; i < hist.size(); i++)
+    int ch;
+    while (ch = getopt(argc, argv, "s:S:L:i:C:o:DrT:MA:N:"), ch != -1)
+    {
+        switch (ch)
         {
-            if (lo_bin == -1 && hist[i] > lo_thresh)
-            {
-                lo_bin = i;
-                hi_bin = i;
-            }
-            else if (hist[i] > hi_thresh)
-            {
-                hi_bin = i;
-            }
+        case 's':
+            ret.stats_interval = std::stoi(optarg);
+            break;
+        case 'S':
+            ret.stats_path = optarg;
+            break;
+        case 'L':
+            ret.layer = std::stoi(optarg);
+            break;
+        case 'i':
+            ret.stream = std::stoi(optarg);
+            break;
+        case 'o':
+            ret.record_path = optarg;
+            break;
+        case 'D':
+            ret.record_config.direct_io = true;
+            break;
+        case 'r':
+            ret.compression = VideoFrame::Compression::PACKED;
+            break;
+        case 'T':
+            if (!load_thread_config(optarg))
+                errx(1, "bad thread config %s", optarg);
+            break;
+        case 'M':
+            if (!lock_memory())
+                errx(1, "cannot lock memory");
+            break;
+        case 'N':
+            // HIGH needs the camera pointed at a warm flat field
+            if (!strcmp(optarg, "low"))
+                ret.nuc_reference = 0;
+            else if (!strcmp(optarg, "high"))
+                ret.nuc_reference = 1;
+            else
+                errx(1, "NUC reference must be low or high");
+            break;
+        case 'A':
+            ret.clahe_clip_limit = std::stof(optarg);
+            break;
+        case 'C':
+            if (sscanf(optarg, "%hu:%hu:%hu:%hu", &ret.crop.x, &ret.crop.y, &ret.crop.width, &ret.crop.height) != 4)
+                errx(1, "crop must be x:y:width:height");
+            break;
+        case '?':
+            errx(1, "usage: %s [-s stats_interval] [-S stats_file] [-L layer] [-i stream] [-C x:y:w:h] [-o record_file] [-D] [-r] [-T thread_config] [-M] [-A clahe_clip_limit] [-N low|high] [connect_addr] [connect_port]", *argv);
         }
+    }
 
-        printf("hist: lo(%d) hi(%d) / %d - %d\n", lo_bin, hi_bin, lo_bin*256, (hi_bin + 1)*256);
-
-        uint16_t vmin = lo_bin * 256, vmax = ((hi_bin + 1) * 256 - 1);
-        uint16_t vspan = vmax - vmin;
+    if (argc - optind < 2)
+        errx(1, "usage: %s [-s stats_interval] [-S stats_file] [-L layer] [-i stream] [-C x:y:w:h] [-o record_file] [-D] [-r] [-T thread_config] [-M] [-A clahe_clip_limit] [-N low|high] [connect_addr] [connect_port]", *argv);
 
-		for (size_t i = 0; i < img.size[0]*img.size[1]; i++)
-		{
-			uint16_t &v = img.at<uint16_t>(i);
+    const auto connect_addr = argv[optind];
+    const auto connect_port = std::stoi(argv[optind + 1]);
 
-            v -= vmin;
-            v = 65535 * v / vspan;
+    ret.video_rx = std::make_unique<IpVideoClient>(connect_addr, connect_port, ret.layer, ret.compression, ret.stream);
 
-			//v = std::sqrt(v / 65535.0f) / 4;
-			//v = std::min(65535, std::max(0, v - 1500) * 65535 / 10000);
-		}
-
-
-		return frame;
-	}
-};
+    // Recording taps the frames as received, the codestream is stored
+    // without decoding it
+    auto &record_branch = ret.rx_pipeline.add_branch({64, Backpressure::DROP_NEWEST});
 
-struct VideoRecieverContext
-{
-    IVideoRxPtr video_rx;
-    FramePipeline<VideoFrame> rx_pipeline;
-};
+    if (ret.record_path.empty())
+    {
+        record_branch.make_component<BitUnpacker>();
+        record_branch.make_component<VideoSequenceWriter>("OUT");
+    }
+    else
+    {
+        ret.recorder = &record_branch.make_component<VideoContainerWriter>(ret.record_path, ret.record_config);
+    }
 
-VideoRecieverContext create_context(int argc, char **argv)
-{
-    VideoRecieverContext ret;
+    ret.display_branch = &ret.rx_pipeline.add_branch({2, Backpressure::DROP_OLDEST});
 
-    if (argc < 3)
-        errx(1, "usage: [connect_addr] [connect_port]");
+    if (ret.clahe_clip_limit > 0)
+    {
+        Clahe::Config clahe_config;
+        clahe_config.clip_limit = ret.clahe_clip_limit;
 
-    const auto connect_addr = argv[1];
-    const auto connect_port = std::stoi(argv[2]);
+        add_display_chain<Clahe>(*ret.display_branch, clahe_config);
+    }
+    else
+    {
+        add_display_chain<HistogramEqualizer>(*ret.display_branch, HistogramEqualizer());
+    }
 
-    ret.video_rx = std::make_unique<IpVideoClient>(connect_addr, connect_port);
-    ret.rx_pipeline.make_component<JpegLsDecoder>();
-    ret.rx_pipeline.make_component<HistogramEqualizer>();
-    ret.rx_pipeline.make_component<VideoSequenceWriter>("OUT");
+    ret.rx_pipeline.enable_profiling(ret.stats_interval > 0);
 
     return ret;
 }
@@ -101,7 +161,14 @@ int main(int argc, char **argv)
 {
     auto ctx = create_context(argc, argv);
 
+    configure_current_thread("recv_video");
+
     ctx.video_rx->connect();
+
+    if (ctx.crop.width && ctx.crop.height)
+        ctx.video_rx->send_control_message(make_set_crop_message(ctx.crop));
+    if (ctx.nuc_reference >= 0)
+        ctx.video_rx->send_control_message(make_calibrate_nuc_message(ctx.stream, ctx.nuc_reference));
     const auto frame_format = ctx.video_rx->get_frame_format();
 
     printf("video format: (%dx%d) (%d channel) (%d bpp)\n",
@@ -111,16 +178,50 @@ int main(int argc, char **argv)
 	auto display = create_glfw_video_display(1280, 960);
 	display->open();
 
+	FrameQueue<VideoFramePtr> display_queue(1, Backpressure::DROP_OLDEST);
+
+	ctx.display_branch->set_output_handler([&](const VideoFramePtr &frame) {
+		display_queue.push(frame);
+	});
+	ctx.rx_pipeline.start();
+
+	std::unique_ptr<StatsReporter> stats_reporter;
+
+	if (ctx.stats_interval > 0)
+	{
+		stats_reporter = std::make_unique<StatsReporter>(std::chrono::seconds(ctx.stats_interval), ctx.stats_path,
+				[&](FILE *fp) {
+					ctx.rx_pipeline.dump_stats(fp);
+
+					if (ctx.recorder)
+						ctx.recorder->dump_stats(fp);
+
+					dump_thread_stats(fp);
+				});
+	}
+
+	signal(SIGUSR1, request_trigger);
+
 	while (1)
 	{
-		auto frame = ctx.rx_pipeline.process_frame(ctx.video_rx->recv_frame());
+		if (trigger_requested)
+		{
+			trigger_requested = 0;
+			ctx.video_rx->send_control_message(make_trigger_recording_message(ctx.stream));
+		}
 
-		display->set_video_frame(frame);
+		ctx.rx_pipeline.push_frame(ctx.video_rx->recv_frame());
+
+		if (VideoFramePtr frame; display_queue.try_pop(frame))
+			display->set_video_frame(frame);
 
 		if (!display->update())
 			break;
 	}
 
+	stats_reporter.reset();
+	ctx.rx_pipeline.stop();
+
     return 0;
 }
 
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+
+// Paces a loop to a frame rate on absolute CLOCK_MONOTONIC deadlines, so
+// the rate doesn't drift with the time spent per frame. After a stall of
+// more than a period the schedule restarts instead of bursting to catch up.
+class FramePacer
+{
+public:
+	// A rate of 0 or less never waits
+	FramePacer(double fps):
+		_period_ns(fps > 0 ? 1e9 / fps : 0),
+		_deadline_ns(now_ns())
+	{
+	}
+
+	auto wait() -> void
+	{
+		if (!_period_ns)
+			return;
+
+		timespec ts{(time_t)(_deadline_ns / 1000000000), (long)(_deadline_ns % 1000000000)};
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+			;
+
+		if (uint64_t now = now_ns(); now > _deadline_ns + _period_ns)
+			_deadline_ns = now;
+
+		_deadline_ns += _period_ns;
+	}
+
+	static auto now_ns() -> uint64_t
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+
+		return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+private:
+	uint64_t _period_ns;
+	uint64_t _deadline_ns;
+};
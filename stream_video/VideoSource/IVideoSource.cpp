@@ -1,27 +1,57 @@
 #include "IVideoSource.h"
 #include "UVCVideoSource.h"
 #include "RecordingVideoSource.h"
+#include "SyntheticVideoSource.h"
 
 auto open_video_source(VideoSourceType type, const VideoSourceParams &params) -> IVideoSourcePtr
 {
 	if (type == VideoSourceType::UVC_CAMERA)
 	{
 		if (auto it = params.find("id"); it != params.end())
-		{
-			// NOT IMPLEMENTED
-			// return std::make_unique<UVCVideoSource>(std::stoi(it->second));
-		}
-		else
-		{
-			return std::make_unique<UVCVideoSource>();
-		}
+			return std::make_unique<UVCVideoSource>(it->second);
+
+		return std::make_unique<UVCVideoSource>();
 	}
 	else if (type == VideoSourceType::FILE_SEQ)
 	{
 		auto path = params.at("path");
-		auto fps = std::stoi(params.at("fps"));
 
-		return std::make_unique<RecordingVideoSource>(path, fps);
+		PlaybackConfig config;
+
+		if (auto it = params.find("fps"); it != params.end())
+			config.fps = std::stoi(it->second);
+
+		if (auto it = params.find("speed"); it != params.end())
+			config.speed = std::stod(it->second);
+
+		config.loop = params.count("loop") && params.at("loop") == "1";
+		config.passthrough = params.count("passthrough") && params.at("passthrough") == "1";
+
+		return std::make_unique<RecordingVideoSource>(path, config);
+	}
+	else if (type == VideoSourceType::SYNTHETIC)
+	{
+		SyntheticConfig config;
+
+		for (const auto &[key, value] : params)
+		{
+			if (key == "width")
+				config.width = std::stoi(value);
+			else if (key == "height")
+				config.height = std::stoi(value);
+			else if (key == "bits")
+				config.bits = std::stoi(value);
+			else if (key == "fps")
+				config.fps = std::stod(value);
+			else if (key == "scene")
+				config.scene = value == "static" ? SyntheticConfig::Scene::STATIC : SyntheticConfig::Scene::GRADIENT;
+			else if (key == "noise")
+				config.noise = std::stoi(value);
+			else if (key == "hot_spots")
+				config.hot_spots = std::stoi(value);
+		}
+
+		return std::make_unique<SyntheticVideoSource>(config);
 	}
 
 	return nullptr;
@@ -13,6 +13,7 @@ enum class VideoSourceType
 {
     UVC_CAMERA,
 	FILE_SEQ,
+	SYNTHETIC,
 };
 
 class IVideoSource
@@ -23,6 +24,12 @@ public:
     virtual auto handle_read_frame(const ReadFrameHandler &handler) -> void = 0;
     virtual auto get_video_format() -> VideoFrame::Format = 0;
     virtual auto start() -> bool = 0;
+
+    // Closes the sensor's shutter for a moment, false if there is none
+    virtual auto trigger_shutter() -> bool
+    {
+        return false;
+    }
 };
 
 using IVideoSourcePtr = std::unique_ptr<IVideoSource>;
@@ -1,9 +1,12 @@
 #include "RecordingVideoSource.h"
+#include "storage/PrefetchingVideoReader.h"
+#include "FramePacer.h"
+#include "ThreadConfig.h"
 #include <chrono>
 
-RecordingVideoSource::RecordingVideoSource(const std::string &path, int fps):
-	_fps(fps),
-	_seq_reader(path)
+RecordingVideoSource::RecordingVideoSource(const std::string &path, const PlaybackConfig &config):
+	_config(config),
+	_reader(std::make_unique<PrefetchingVideoReader>(open_video_reader(path), 8, 0, !config.passthrough))
 {
 }
 
@@ -14,41 +17,53 @@ auto RecordingVideoSource::handle_read_frame(const ReadFrameHandler &handler) ->
 
 auto RecordingVideoSource::get_video_format() -> VideoFrame::Format
 {
-	auto frame = _seq_reader.read_frame();
-	_seq_reader.rewind();
+	// Decoded even in passthrough, stored PACKED frames carry their packed
+	// depth rather than the 16 bits the decode pipeline turns them into
+	auto frame = _reader->read_frame(0);
 
-	return frame->format;
+	if (!frame)
+		return {};
+
+	// Of the full sensor frame, telemetry rows included
+	auto format = frame->format;
+	format.height += joined_telemetry_rows(*frame);
+
+	return format;
 }
 
 auto RecordingVideoSource::start() -> bool
 {
 	_thread = std::make_unique<std::thread>([&](){
-		int us_delta = 1000000 / _fps;
+		configure_current_thread("playback");
 
-		std::chrono::system_clock clk;
-		auto send_time = std::chrono::time_point_cast<std::chrono::microseconds>(clk.now());
+		FramePacer pacer(_config.fps * _config.speed);
+		uint64_t sequence = 0;
 
 		while (1)
 		{
-			auto frame = _seq_reader.read_frame();
-			
-			if (frame == nullptr)
-				break;
+			auto frame = _reader->read_frame();
 
-			while (1)
+			if (frame == nullptr && _config.loop && sequence)
 			{
-				auto now = std::chrono::time_point_cast<std::chrono::microseconds>(clk.now());
-
-				if ((now - send_time).count() > us_delta)
-				{
-					send_time = now;
-					_handler(frame);
-					break;
-				}
+				_reader->rewind();
+				frame = _reader->read_frame();
 			}
+
+			if (frame == nullptr)
+				break;
+
+			if (!_config.passthrough)
+				frame = _telemetry_joiner.process_frame(frame);
+
+			pacer.wait();
+
+			frame->metadata.sequence = sequence++;
+			frame->metadata.capture_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+
+			_handler(frame);
 		}
 	});
 
 	return true;
 }
-
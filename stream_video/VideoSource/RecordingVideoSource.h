@@ -1,19 +1,33 @@
 #pragma once
-#include "storage/VideoSequenceReader.h"
+#include "storage/IVideoReader.h"
 #include "IVideoSource.h"
+#include "processing/Telemetry.h"
 #include <thread>
 
+struct PlaybackConfig
+{
+	// 0 hands out frames as fast as they are read
+	int fps{24};
+	double speed{1.0};
+	bool loop{false};
+
+	// Frames are handed out as stored, compressed and with their telemetry
+	// split off. Otherwise they are decoded to what the camera would deliver.
+	bool passthrough{false};
+};
+
 class RecordingVideoSource : public IVideoSource
 {
 public:
-	RecordingVideoSource(const std::string &path, int fps);
+	RecordingVideoSource(const std::string &path, const PlaybackConfig &config = {});
 
     auto handle_read_frame(const ReadFrameHandler &handler) -> void override;
     auto get_video_format() -> VideoFrame::Format override;
     auto start() -> bool override;
 private:
-	int _fps;
-	VideoSequenceReader _seq_reader;
+	PlaybackConfig _config;
+	IVideoReaderPtr _reader;
+	TelemetryJoiner _telemetry_joiner;
 	ReadFrameHandler _handler;
 	std::unique_ptr<std::thread> _thread;
 };
@@ -0,0 +1,141 @@
+#include "SyntheticVideoSource.h"
+#include "FramePacer.h"
+#include "ThreadConfig.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// Rows of the noise table past the frame size, frames start it at a random
+// row so consecutive frames don't repeat the same noise
+constexpr size_t noise_slack_rows = 64;
+
+SyntheticVideoSource::SyntheticVideoSource(const SyntheticConfig &config):
+	_config(config)
+{
+	_config.bits = std::clamp<uint16_t>(_config.bits, 1, 16);
+
+	_format.width = _config.width;
+	_format.height = _config.height;
+	_format.num_components = 1;
+	_format.bits_per_pixel = 16;
+
+	const size_t count = (size_t)_format.width * _format.height;
+	const uint32_t max_value = (1u << _config.bits) - 1;
+
+	_scene.resize(count);
+
+	for (size_t y = 0; y < _format.height; y++)
+	{
+		for (size_t x = 0; x < _format.width; x++)
+		{
+			uint32_t v = max_value / 4;
+
+			if (_config.scene == SyntheticConfig::Scene::GRADIENT)
+				v += (uint64_t)max_value / 2 * (x + y) / (_format.width + _format.height);
+
+			_scene[y * _format.width + x] = v;
+		}
+	}
+
+	if (_config.noise)
+	{
+		std::mt19937 rng(1);
+		std::uniform_int_distribution<int> dist(-_config.noise, _config.noise);
+
+		_noise.resize(count + noise_slack_rows * _format.width);
+
+		for (auto &v : _noise)
+			v = dist(rng);
+	}
+}
+
+SyntheticVideoSource::~SyntheticVideoSource()
+{
+	_stop = true;
+
+	if (_thread)
+		_thread->join();
+}
+
+auto SyntheticVideoSource::handle_read_frame(const ReadFrameHandler &handler) -> void
+{
+	_handler = handler;
+}
+
+auto SyntheticVideoSource::get_video_format() -> VideoFrame::Format
+{
+	return _format;
+}
+
+auto SyntheticVideoSource::start() -> bool
+{
+	_thread = std::make_unique<std::thread>([&](){
+		configure_current_thread("synthetic");
+
+		FramePacer pacer(_config.fps);
+
+		for (uint64_t sequence = 0; !_stop; sequence++)
+		{
+			auto frame = _pool.acquire(_scene.size() * sizeof(uint16_t));
+			frame->format = _format;
+
+			render(*frame, sequence);
+
+			pacer.wait();
+
+			frame->metadata.sequence = sequence;
+			frame->metadata.capture_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+
+			_handler(std::move(frame));
+		}
+	});
+
+	return true;
+}
+
+auto SyntheticVideoSource::render(VideoFrame &frame, uint64_t sequence) -> void
+{
+	auto *px = (uint16_t*)frame.buffer.data();
+	const size_t count = _scene.size();
+	const int32_t max_value = (1 << _config.bits) - 1;
+
+	if (_noise.empty())
+	{
+		memcpy(px, _scene.data(), count * sizeof(uint16_t));
+	}
+	else
+	{
+		// Cheap per-frame variation: a different window of the table
+		const int16_t *noise = _noise.data() + (sequence * 7919 % noise_slack_rows) * _format.width;
+
+		for (size_t i = 0; i < count; i++)
+			px[i] = std::clamp<int32_t>(_scene[i] + noise[i], 0, max_value);
+	}
+
+	// Each spot runs its own Lissajous path
+	const int radius = std::max(2, _format.height / 16);
+	const uint16_t hot = max_value * 7 / 8;
+
+	for (int spot = 0; spot < _config.hot_spots; spot++)
+	{
+		double t = sequence * 0.02 * (1 + spot * 0.37);
+		int cx = (0.5 + 0.4 * std::sin(t + spot)) * _format.width;
+		int cy = (0.5 + 0.4 * std::cos(1.3 * t + 2 * spot)) * _format.height;
+
+		int y0 = std::max(0, cy - radius);
+		int y1 = std::min<int>(_format.height, cy + radius + 1);
+
+		for (int y = y0; y < y1; y++)
+		{
+			int half = std::sqrt(radius * radius - (y - cy) * (y - cy));
+			int x0 = std::max(0, cx - half);
+			int x1 = std::min<int>(_format.width, cx + half + 1);
+
+			if (x0 < x1)
+				std::fill(px + (size_t)y * _format.width + x0, px + (size_t)y * _format.width + x1, hot);
+		}
+	}
+}
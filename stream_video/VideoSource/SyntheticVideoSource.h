@@ -0,0 +1,56 @@
+#pragma once
+#include "IVideoSource.h"
+#include "FramePool.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct SyntheticConfig
+{
+	// Of the full frame, the sensor's telemetry rows included
+	uint16_t width{640};
+	uint16_t height{512};
+
+	// Samples are stored in 16 bits and span [0, 2^bits)
+	uint16_t bits{14};
+
+	// 0 hands out frames as fast as they are made
+	double fps{30};
+
+	enum class Scene
+	{
+		STATIC, // one flat level
+		GRADIENT,
+	} scene{Scene::GRADIENT};
+
+	// Peak amplitude of the per-pixel noise
+	uint16_t noise{16};
+
+	// Hot discs moving across the scene
+	uint16_t hot_spots{2};
+};
+
+// Test pattern generator for running the stream without a camera. The
+// scene and a noise table are made once, a frame costs about a copy.
+class SyntheticVideoSource : public IVideoSource
+{
+public:
+	SyntheticVideoSource(const SyntheticConfig &config = {});
+	~SyntheticVideoSource();
+
+	auto handle_read_frame(const ReadFrameHandler &handler) -> void override;
+	auto get_video_format() -> VideoFrame::Format override;
+	auto start() -> bool override;
+
+private:
+	SyntheticConfig _config;
+	VideoFrame::Format _format;
+	std::vector<uint16_t> _scene;
+	std::vector<int16_t> _noise;
+	FramePool _pool;
+	ReadFrameHandler _handler;
+	std::atomic<bool> _stop{false};
+	std::unique_ptr<std::thread> _thread;
+
+	auto render(VideoFrame &frame, uint64_t sequence) -> void;
+};
@@ -1,24 +1,28 @@
 #include "UVCVideoSource.h"
+#include "ThreadConfig.h"
 #include "libuvc/libuvc.h"
+#include <chrono>
+#include <cinttypes>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <err.h>
 
 #define UVC_SHUTTER 0x8000
 #define UVC_MODE_RADIOMETRIC 0x8004
 
-UVCVideoSource::UVCVideoSource()
+constexpr int camera_vid = 0x1514;
+constexpr int camera_pid = 0x0001;
+
+UVCVideoSource::UVCVideoSource(const std::string &id):
+    _queue(4, Backpressure::DROP_OLDEST)
 {
     uvc_error_t err;
 
     if (err = uvc_init(&_ctx, 0); err != UVC_SUCCESS)
         errx(1, "uvc_init (%s)", uvc_strerror(err));
 
-    int vid{0x1514}, pid{0x0001};
-    const char *sn = nullptr;
-
-    if (err = uvc_find_device(_ctx, &_dev, vid, pid, sn); err != UVC_SUCCESS)
-        errx(1, "uvc_find_device (%s)", uvc_strerror(err));
+    _dev = find_device(id);
 
     if (err = uvc_open(_dev, &_handle); err != UVC_SUCCESS)
         errx(1, "uvc_open (%s)", uvc_strerror(err));
@@ -33,7 +37,7 @@ UVCVideoSource::UVCVideoSource()
         errx(1, "uvc_get_stream_ctrl_format_size (%s)", uvc_strerror(err));
 
     set_mode_radiometric();
-    shutter();
+    trigger_shutter();
 
     _video_format.width = frame_desc->wWidth;
     _video_format.height = frame_desc->wHeight;
@@ -41,9 +45,56 @@ UVCVideoSource::UVCVideoSource()
     _video_format.bits_per_pixel = 16;
 }
 
-void UVCVideoSource::shutter()
+UVCVideoSource::~UVCVideoSource()
 {
-    uvc_set_zoom_abs(_handle, UVC_SHUTTER);
+    if (!_handler_thread)
+        return;
+
+    uvc_stop_streaming(_handle);
+
+    _queue.close();
+    _handler_thread->join();
+}
+
+auto UVCVideoSource::find_device(const std::string &id) -> uvc_device_t*
+{
+    uvc_device_t *ret = nullptr;
+    uvc_error_t err;
+    unsigned bus, address;
+
+    if (sscanf(id.c_str(), "%u:%u", &bus, &address) != 2)
+    {
+        if (err = uvc_find_device(_ctx, &ret, camera_vid, camera_pid, id.empty() ? nullptr : id.c_str()); err != UVC_SUCCESS)
+            errx(1, "uvc_find_device %s (%s)", id.c_str(), uvc_strerror(err));
+
+        return ret;
+    }
+
+    uvc_device_t **list;
+
+    if (err = uvc_get_device_list(_ctx, &list); err != UVC_SUCCESS)
+        errx(1, "uvc_get_device_list (%s)", uvc_strerror(err));
+
+    for (size_t i = 0; list[i] && !ret; i++)
+    {
+        if (uvc_get_bus_number(list[i]) == bus && uvc_get_device_address(list[i]) == address)
+        {
+            uvc_ref_device(list[i]);
+            ret = list[i];
+        }
+    }
+
+    uvc_free_device_list(list, 1);
+
+    if (!ret)
+        errx(1, "no camera at %s", id.c_str());
+
+    return ret;
+}
+
+auto UVCVideoSource::trigger_shutter() -> bool
+{
+    return uvc_set_zoom_abs(_handle, UVC_SHUTTER) == UVC_SUCCESS;
 }
 
 void UVCVideoSource::set_mode_radiometric()
@@ -61,37 +112,64 @@ auto UVCVideoSource::get_video_format() -> VideoFrame::Format
     return _video_format;
 }
 
-struct CallbackState
+auto UVCVideoSource::dropped_frames() const -> uint64_t
 {
-	IVideoSource::ReadFrameHandler *handler;
-};
+    return _queue.dropped();
+}
 
-void frame_callback(uvc_frame *uvc_frame, void *user_ptr)
+// Runs on libuvc's transfer thread, has to return quickly. The transfer
+// buffer is reused by libuvc once we return, so it is copied.
+void UVCVideoSource::frame_callback(uvc_frame *uvc_frame, void *user_ptr)
 {
-	const auto *cb_state = (CallbackState*)user_ptr;
+	auto *source = (UVCVideoSource*)user_ptr;
 
-	auto video_frame = std::make_shared<VideoFrame>();
-	video_frame->buffer.resize(uvc_frame->data_bytes);
+	// libuvc's transfer thread, only reachable from here
+	if (!source->_transfer_thread_configured)
+	{
+		configure_current_thread("uvc-transfer");
+		source->_transfer_thread_configured = true;
+	}
+
+	auto video_frame = source->_pool.acquire(uvc_frame->data_bytes);
 	memcpy(video_frame->buffer.data(), uvc_frame->data, uvc_frame->data_bytes);
+	video_frame->format = source->_video_format;
+	video_frame->metadata.sequence = source->_sequence++;
+	video_frame->metadata.capture_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
 
-    (*cb_state->handler)(video_frame);
+	source->_queue.push(std::move(video_frame));
 }
 
-static CallbackState _cb_state;
-
 bool UVCVideoSource::start()
 {
     uvc_error_t err;
 
-	_cb_state.handler = &_read_frame_handler;
-
-    if (err = uvc_start_streaming(_handle, &_stream_ctrl, frame_callback, &_cb_state, 0); err != UVC_SUCCESS)
+    if (err = uvc_start_streaming(_handle, &_stream_ctrl, frame_callback, this, 0); err != UVC_SUCCESS)
 
     {
         warnx("uvc_start_streaming (%s)", uvc_strerror(err));
         return false;
     }
 
+	_handler_thread = std::make_unique<std::thread>([this](){
+		configure_current_thread("uvc-handler");
+
+		VideoFramePtr frame;
+		uint64_t reported_drops = 0;
+
+		while (_queue.pop(frame))
+		{
+			if (uint64_t drops = _queue.dropped(); drops != reported_drops)
+			{
+				printf("[!] handler fell behind, %" PRIu64 " frames dropped\n", drops - reported_drops);
+				reported_drops = drops;
+			}
+
+			_read_frame_handler(std::move(frame));
+			frame = nullptr;
+		}
+	});
+
     return true;
 }
 
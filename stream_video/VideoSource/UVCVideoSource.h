@@ -1,8 +1,12 @@
 #pragma once
 
 #include "IVideoSource.h"
+#include "FramePool.h"
+#include "FrameQueue.h"
 #include "libuvc/libuvc.h"
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 class UVCVideoSource : public IVideoSource
@@ -17,14 +21,31 @@ private:
 	VideoFrame::Format _video_format;
     ReadFrameHandler _read_frame_handler;
 
-    void shutter();
+    // libuvc's callback only copies the frame and queues it, the handler
+    // runs on _handler_thread so a slow handler can't stall USB transfers
+    FramePool _pool;
+    FrameQueue<VideoFramePtr> _queue;
+    std::unique_ptr<std::thread> _handler_thread;
+    uint64_t _sequence{0};
+    bool _transfer_thread_configured{false};
+
     void set_mode_radiometric();
+    auto find_device(const std::string &id) -> uvc_device_t*;
+
+    static void frame_callback(uvc_frame *uvc_frame, void *user_ptr);
 
 public:
-    UVCVideoSource();
+    // id picks the camera by serial number or as "bus:address", empty for
+    // the first one found
+    UVCVideoSource(const std::string &id = "");
+    ~UVCVideoSource();
 
     auto handle_read_frame(const ReadFrameHandler &handler) -> void override;
     auto get_video_format() -> VideoFrame::Format override;
     auto start() -> bool override;
+    auto trigger_shutter() -> bool override;
+
+    // Frames the handler fell too far behind for, the oldest ones go
+    auto dropped_frames() const -> uint64_t;
 };
 
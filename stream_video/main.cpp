@@ -1,31 +1,107 @@
 #include "VideoSource/IVideoSource.h"
 #include "transport/IpVideoServer.h"
+#include "compression/BitPack.h"
 #include "compression/JpegLs.h"
+#include "processing/Downscaler.h"
+#include "processing/NonUniformityCorrection.h"
+#include "processing/Telemetry.h"
+#include "processing/TemporalDenoiser.h"
+#include "storage/PreEventRecorder.h"
 #include "FramePipeline.h"
+#include "profiling/PipelineStats.h"
+#include "ThreadConfig.h"
+#include <csignal>
 #include <cstring>
 #include <getopt.h>
 #include <cstdio>
 #include <err.h>
+#include <memory>
+#include <sstream>
+#include <vector>
 
-struct VideoStremerContext
+// One resolution of the stream, downscaled 2x from the layer above it
+struct Layer
+{
+    VideoFrame::Format format;
+    std::unique_ptr<Downscaler> downscaler;
+    std::unique_ptr<JpegLsEncoder> encoder;
+    std::unique_ptr<BitPacker> packer;
+};
+
+// The sensor appends its telemetry as extra rows below the image
+constexpr uint16_t telemetry_rows = 4;
+
+// Frames still queued or taken while the shutter closes, not averaged into
+// the LOW reference
+constexpr size_t shutter_settle_frames = 8;
+
+// Averaged into a reference requested by a client when -n didn't set it
+constexpr size_t default_nuc_frames = 16;
+
+// Everything one camera needs, frames of a stream are captured, processed,
+// encoded and sent on that source's own thread
+struct Stream
 {
     IVideoSourcePtr video_source;
-    IVideoTxPtr video_tx;
-    JpegLsEncoder jpeg_encoder;
     FramePipeline<VideoFrame> pre_tx_pipeline;
+
+    // Turns stored frames from a passthrough source back into sensor frames
+    FramePipeline<VideoFrame> decode_pipeline;
+    std::vector<Layer> layers;
+    std::unique_ptr<PreEventRecorder> recorder;
+    NonUniformityCorrection *nuc{nullptr};
+    VideoFrame::Format frame_format;
+    int cpu{-1};
+    bool configured{false};
+};
+
+struct VideoStremerContext
+{
+    IVideoTxPtr video_tx;
+    std::vector<std::unique_ptr<Stream>> streams;
+    int stats_interval{0};
+    std::string stats_path{""};
+    size_t nuc_frames{0};
 };
 
+// For the SIGUSR1 handler, only set before it is installed
+static PreEventRecorder *event_recorders[max_streams];
+
+static void trigger_recorders(int)
+{
+    for (auto *recorder : event_recorders)
+    {
+        if (recorder)
+            recorder->trigger();
+    }
+}
+
 VideoStremerContext create_context(int argc, char **argv)
 {
     VideoStremerContext ret;
 
-	bool use_usbdev{true};
-	std::string recording_path{""};
+	struct StreamSource
+	{
+		VideoSourceType type;
+		VideoSourceParams params;
+	};
+
+	std::vector<StreamSource> sources;
 	std::string listen_addr{"0.0.0.0"};
 	std::string listen_port{"9000"};
+	std::string bad_pixels_path{""};
+	int denoise_threshold{0};
+	int num_layers{3};
+	bool passthrough{false};
+	std::string fps{"24"};
+	std::string speed{"1"};
+	bool loop{false};
+	std::vector<int> cpus;
+	std::string event_path{""};
+	PreEventConfig event_config;
 
 	int ch;
-	while (ch = getopt(argc, argv, "l:f:"), ch != -1)
+	while (ch = getopt(argc, argv, "l:c:f:n:b:d:L:PF:x:rt:p:T:Ms:S:e:E:"), ch != -1)
 	{
 		switch (ch)
 		{
@@ -42,59 +118,410 @@ VideoStremerContext create_context(int argc, char **argv)
 				}
 			}
 
+			break;
+		case 'c':
+			// UVC serial number or bus:address
+			sources.push_back({VideoSourceType::UVC_CAMERA, {{"id", optarg}}});
+
 			break;
 		case 'f':
-			recording_path = optarg;
-			use_usbdev = false;
+			sources.push_back({VideoSourceType::FILE_SEQ, {{"path", optarg}}});
+
+			break;
+		case 'n':
+			ret.nuc_frames = std::stoul(optarg);
+
+			break;
+		case 'b':
+			bad_pixels_path = optarg;
+
+			break;
+		case 'd':
+			denoise_threshold = std::stoi(optarg);
+
+			break;
+		case 'L':
+			num_layers = std::stoi(optarg);
+
+			if (num_layers < 1 || num_layers > max_layers)
+				errx(1, "layers must be between 1 and %d", max_layers);
+
+			break;
+		case 'P':
+			passthrough = true;
+
+			break;
+		case 'F':
+			fps = optarg;
+
+			break;
+		case 'x':
+			speed = optarg;
+
+			break;
+		case 'r':
+			loop = true;
+
+			break;
+		case 't':
+			// key=value,... see SyntheticConfig
+			{
+				StreamSource source{VideoSourceType::SYNTHETIC, {}};
+				std::istringstream params(optarg);
+
+				for (std::string token; std::getline(params, token, ',');)
+				{
+					if (auto eq = token.find('='); eq != std::string::npos)
+						source.params[token.substr(0, eq)] = token.substr(eq + 1);
+				}
+
+				sources.push_back(std::move(source));
+			}
+
+			break;
+		case 'p':
+			// cpu,cpu,... one per stream in the order they were given
+			{
+				std::istringstream list(optarg);
+
+				for (std::string token; std::getline(list, token, ',');)
+					cpus.push_back(std::stoi(token));
+			}
+
+			break;
+		case 'T':
+			// Before any thread is started, see load_thread_config
+			if (!load_thread_config(optarg))
+				errx(1, "bad thread config %s", optarg);
+
+			break;
+		case 'M':
+			if (!lock_memory())
+				errx(1, "cannot lock memory");
+
+			break;
+		case 's':
+			ret.stats_interval = std::stoi(optarg);
+
+			break;
+		case 'S':
+			ret.stats_path = optarg;
+
+			break;
+		case 'e':
+			event_path = optarg;
+
+			break;
+		case 'E':
+			if (sscanf(optarg, "%lf:%lf", &event_config.pre_event_s, &event_config.post_event_s) != 2)
+				errx(1, "event window must be pre_seconds:post_seconds");
 
 			break;
 		case '?':
-			errx(1, "usage: %s [-l [addr]:port] [-f file]", *argv);
+			errx(1, "usage: %s [-l [addr]:port] [-c camera_id]... [-f file]... [-t key=value,...]... [-p cpu,...] [-T thread_config] [-M] [-s stats_interval] [-S stats_file] [-e event_dir] [-E pre:post] [-n nuc_frames] [-b bad_pixels] [-d denoise_threshold] [-L layers] [-P] [-F fps] [-x speed] [-r]", *argv);
 		}
 	}
 
+	if (sources.empty())
+		sources.push_back({VideoSourceType::UVC_CAMERA, {}});
+
+	if (sources.size() > max_streams)
+		errx(1, "at most %u streams", max_streams);
+
     ret.video_tx = std::make_unique<IpVideoServer>(listen_addr, std::stoi(listen_port));
 
-	if (!recording_path.empty())
+	// Processing would be skipped for frames sent as stored
+	if (passthrough && (ret.nuc_frames || !bad_pixels_path.empty() || denoise_threshold > 0))
 	{
-		ret.video_source = open_video_source(VideoSourceType::FILE_SEQ, {{"path", recording_path}, {"fps", "24"}});
+		warnx("passthrough needs no processing, disabled");
+		passthrough = false;
 	}
-	else
+
+	for (size_t s = 0; s < sources.size(); s++)
 	{
-		ret.video_source = open_video_source(VideoSourceType::UVC_CAMERA);
-	}
+		auto &[type, params] = sources[s];
+		auto stream = std::make_unique<Stream>();
+
+		if (type == VideoSourceType::FILE_SEQ)
+		{
+			params.insert({{"fps", fps}, {"speed", speed}, {"loop", loop ? "1" : "0"}, {"passthrough", passthrough ? "1" : "0"}});
+		}
+		else if (type == VideoSourceType::SYNTHETIC)
+		{
+			params.emplace("fps", fps);
+		}
+
+		stream->video_source = open_video_source(type, params);
+		stream->cpu = s < cpus.size() ? cpus[s] : -1;
+
+        // Everything after this sees only image rows, the telemetry goes out raw
+        stream->pre_tx_pipeline.make_component<TelemetrySplitter>(telemetry_rows);
+
+        // References are captured once streaming, see calibrate_nuc
+        if (ret.nuc_frames || !bad_pixels_path.empty())
+        {
+            stream->nuc = &stream->pre_tx_pipeline.make_component<NonUniformityCorrection>();
+
+            if (!bad_pixels_path.empty() && !stream->nuc->load_bad_pixels(bad_pixels_path))
+                err(1, "%s", bad_pixels_path.c_str());
+        }
+
+        // Less temporal noise means fewer bits for JPEG-LS to spend
+        if (denoise_threshold > 0)
+            stream->pre_tx_pipeline.make_component<TemporalDenoiser>(denoise_threshold, 2);
+
+        for (int i = 0; i < num_layers; i++)
+        {
+            auto downscaler = i ? std::make_unique<Downscaler>(2) : nullptr;
+            stream->layers.push_back({{}, std::move(downscaler), std::make_unique<JpegLsEncoder>(), std::make_unique<BitPacker>()});
+        }
+
+        if (passthrough && type == VideoSourceType::FILE_SEQ)
+        {
+            stream->decode_pipeline.make_component<BitUnpacker>();
+            stream->decode_pipeline.make_component<JpegLsDecoder>();
+            stream->decode_pipeline.make_component<TelemetryJoiner>();
+        }
 
-    ret.pre_tx_pipeline.add_component(&ret.jpeg_encoder);
+        // Kept in memory until a trigger, each stream in a directory of its own
+        if (!event_path.empty())
+        {
+            auto path = sources.size() > 1 ? event_path + "/stream" + std::to_string(s) : event_path;
+            stream->recorder = std::make_unique<PreEventRecorder>(path, event_config);
+            event_recorders[s] = stream->recorder.get();
+        }
+
+        ret.streams.push_back(std::move(stream));
+	}
 
     return ret;
 }
 
+// LOW is taken behind the shutter, which is closed for it. HIGH is taken from
+// whatever the camera looks at, which has to be a flat field warmer than the
+// shutter.
+void calibrate_nuc(const VideoStremerContext &ctx, Stream &stream, uint16_t id, NonUniformityCorrection::Reference ref)
+{
+    if (!stream.nuc)
+    {
+        warnx("stream %u: no NUC to calibrate", id);
+        return;
+    }
+
+    size_t skip = 0;
+
+    if (ref == NonUniformityCorrection::Reference::LOW)
+    {
+        if (stream.video_source->trigger_shutter())
+            skip = shutter_settle_frames;
+        else
+            warnx("stream %u: no shutter, LOW reference taken from the scene", id);
+    }
+
+    printf("stream %u: capturing %s NUC reference\n", id, ref == NonUniformityCorrection::Reference::LOW ? "LOW" : "HIGH");
+
+    stream.nuc->capture_reference(ctx.nuc_frames ? ctx.nuc_frames : default_nuc_frames, ref, skip);
+}
+
+// Runs on the stream's source thread
+void process_stream_frame(VideoStremerContext &ctx, Stream &stream, uint16_t id, VideoFramePtr frame)
+{
+    // Settings for "streamN" apply to whichever thread the source runs on
+    if (!stream.configured)
+    {
+        configure_current_thread("stream" + std::to_string(id));
+
+        if (stream.cpu >= 0 && !pin_current_thread(stream.cpu))
+            warnx("stream %u: cannot pin to cpu %d", id, stream.cpu);
+
+        stream.configured = true;
+    }
+
+    printf("stream %u: read_frame (%zu bytes)\n", id, frame->buffer.size());
+
+    // A stored codestream of the full image is exactly what full frame
+    // JPEG-LS clients of layer 0 get, it goes out without a decode
+    const IVideoTx::Subscription stored_subscription{{}, VideoFrame::Compression::JPEG_LS};
+    bool sent_stored = false;
+
+    auto served = [&](size_t layer, const IVideoTx::Subscription &subscription) {
+        return sent_stored && layer == 0 && subscription == stored_subscription;
+    };
+
+    // The pre-event recorder takes the full frame codestream clients get, or
+    // encodes the frame itself when nobody asked for it
+    VideoFramePtr recorded;
+
+    if (frame->compression != VideoFrame::Compression::NONE)
+    {
+        const auto &format = stream.layers[0].format;
+
+        if (frame->compression == VideoFrame::Compression::JPEG_LS && !memcmp(&frame->format, &format, sizeof format))
+        {
+            ctx.video_tx->send_frame(frame, 0, {}, id);
+            sent_stored = true;
+            recorded = frame;
+        }
+
+        bool needs_decode = stream.recorder && !recorded;
+
+        for (size_t i = 0; i < stream.layers.size() && !needs_decode; i++)
+        {
+            for (const auto &subscription : ctx.video_tx->subscriptions(i, id))
+            {
+                if (!served(i, subscription))
+                    needs_decode = true;
+            }
+        }
+
+        if (!needs_decode)
+        {
+            if (stream.recorder)
+                stream.recorder->process_frame(recorded);
+
+            return;
+        }
+
+        if (frame = stream.decode_pipeline.process_frame(frame); !frame)
+            return;
+    }
+
+    size_t imgdata_size = stream.frame_format.width * stream.frame_format.height * 2;
+
+    if (frame->buffer.size() < imgdata_size)
+    {
+        printf("[!] stream %u: incomplete frame\n", id);
+        return;
+    }
+
+    auto level = stream.pre_tx_pipeline.process_frame(frame);
+
+    if (!level)
+        return;
+
+    const auto full = level;
+
+    // Layers below the smallest one anybody watches are not produced
+    size_t num_active = 0;
+
+    for (size_t i = 0; i < stream.layers.size(); i++)
+    {
+        if (ctx.video_tx->has_subscribers(i, id))
+            num_active = i + 1;
+    }
+
+    for (size_t i = 0; i < num_active; i++)
+    {
+        auto &layer = stream.layers[i];
+
+        if (layer.downscaler && !(level = layer.downscaler->process_frame(level)))
+            break;
+
+        for (const auto &subscription : ctx.video_tx->subscriptions(i, id))
+        {
+            if (served(i, subscription))
+                continue;
+
+            const auto &[crop, compression] = subscription;
+            VideoFramePtr encoded;
+
+            if (compression == VideoFrame::Compression::PACKED)
+            {
+                layer.packer->set_crop(crop);
+                encoded = layer.packer->process_frame(level);
+            }
+            else
+            {
+                layer.encoder->set_crop(crop);
+                encoded = layer.encoder->process_frame(level);
+            }
+
+            if (!encoded)
+                continue;
+
+            ctx.video_tx->send_frame(encoded, i, crop, id);
+
+            if (i == 0 && subscription == stored_subscription)
+                recorded = encoded;
+        }
+    }
+
+    if (stream.recorder)
+        stream.recorder->process_frame(recorded ? recorded : full);
+}
+
 int main(int argc, char **argv)
 {
     auto ctx = create_context(argc, argv);
 
-    const auto frame_format = ctx.video_source->get_video_format();
+    configure_current_thread("stream_video");
 
-    ctx.jpeg_encoder.set_frame_format(frame_format);
-    ctx.video_tx->set_frame_format(frame_format);
-    ctx.video_tx->await_connection();
+    for (size_t s = 0; s < ctx.streams.size(); s++)
+    {
+        auto &stream = *ctx.streams[s];
 
-    ctx.video_source->handle_read_frame([&](VideoFramePtr frame) {
-        printf("uvc_read_frame (%zu bytes)\n", frame->buffer.size());
+        stream.frame_format = stream.video_source->get_video_format();
 
-        size_t imgdata_size = frame_format.width * frame_format.height * 2;
+        auto layer_format = stream.frame_format;
+        layer_format.height -= telemetry_rows;
 
-        if (frame->buffer.size() < imgdata_size)
+        for (size_t i = 0; i < stream.layers.size(); i++)
         {
-            printf("[!] incomplete frame\n");
-            return;
+            if (stream.layers[i].downscaler)
+                layer_format = stream.layers[i].downscaler->output_format(layer_format);
+
+            stream.layers[i].format = layer_format;
+            stream.layers[i].encoder->set_frame_format(layer_format);
+            stream.layers[i].packer->set_frame_format(layer_format);
+            ctx.video_tx->set_frame_format(layer_format, i, s);
         }
+    }
 
-        const auto processed_frame = ctx.pre_tx_pipeline.process_frame(frame);
-        ctx.video_tx->send_frame(processed_frame);
+    // Recording is triggered by clients for their stream, or for every
+    // stream with SIGUSR1
+    ctx.video_tx->handle_control_message([&](const ControlMessage &msg) {
+        size_t s = ntohs(msg.params[0]);
+
+        if (s >= ctx.streams.size())
+            return;
+
+        switch ((ControlMessage::Type)ntohs(msg.type))
+        {
+        case ControlMessage::Type::TRIGGER_RECORDING:
+            if (ctx.streams[s]->recorder)
+                ctx.streams[s]->recorder->trigger();
+            break;
+        case ControlMessage::Type::CALIBRATE_NUC:
+            calibrate_nuc(ctx, *ctx.streams[s], s, ntohs(msg.params[1]) ? NonUniformityCorrection::Reference::HIGH
+                    : NonUniformityCorrection::Reference::LOW);
+            break;
+        default:
+            break;
+        }
     });
 
-    ctx.video_source->start();
+    signal(SIGUSR1, trigger_recorders);
+
+    ctx.video_tx->await_connection();
+
+    for (size_t s = 0; s < ctx.streams.size(); s++)
+    {
+        auto &stream = *ctx.streams[s];
+
+        stream.video_source->handle_read_frame([&ctx, &stream, s](VideoFramePtr frame) {
+            process_stream_frame(ctx, stream, s, std::move(frame));
+        });
+
+        stream.video_source->start();
+
+        if (ctx.nuc_frames)
+            calibrate_nuc(ctx, stream, s, NonUniformityCorrection::Reference::LOW);
+    }
+
+    std::unique_ptr<StatsReporter> stats_reporter;
+
+    if (ctx.stats_interval > 0)
+        stats_reporter = std::make_unique<StatsReporter>(std::chrono::seconds(ctx.stats_interval), ctx.stats_path, dump_thread_stats);
 
     while (1)
     {
@@ -103,4 +530,3 @@ int main(int argc, char **argv)
 
     return 0;
 }
-
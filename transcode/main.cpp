@@ -0,0 +1,302 @@
+#include "storage/IVideoReader.h"
+#include "storage/VideoContainerWriter.h"
+#include "compression/BitPack.h"
+#include "compression/JpegLs.h"
+#include "processing/Downscaler.h"
+#include "processing/RadiometricConverter.h"
+#include "processing/Telemetry.h"
+#include "ThreadConfig.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <err.h>
+#include <getopt.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Frames each worker transcodes per batch
+constexpr size_t frames_per_worker = 8;
+
+// One per worker, components keep per-frame state and aren't shared
+struct Transcoder
+{
+    JpegLsDecoder decoder;
+    BitUnpacker unpacker;
+    std::unique_ptr<TelemetrySplitter> splitter;
+    std::unique_ptr<RadiometricConverter> radiometric;
+    std::unique_ptr<Downscaler> downscaler;
+    JpegLsEncoder encoder;
+    BitPacker packer;
+    VideoFrame::Format encoder_format{};
+    uint64_t bytes_in{0};
+};
+
+struct TranscodeContext
+{
+    IVideoReaderPtr reader;
+    std::unique_ptr<VideoContainerWriter> writer;
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<std::unique_ptr<Transcoder>> transcoders;
+    VideoFrame::Compression compression{VideoFrame::Compression::JPEG_LS};
+    bool strip_telemetry{false};
+    size_t decimate{1};
+
+    // Otherwise stored frames are copied as they are
+    bool reencode{false};
+};
+
+TranscodeContext create_context(int argc, char **argv)
+{
+    TranscodeContext ret;
+
+    size_t jobs{0};
+    int near{0};
+    uint16_t telemetry_rows{0};
+    unsigned downscale{1};
+    std::string calibration;
+    ContainerWriterConfig writer_config;
+
+    // Converting offline, nothing is worth dropping a frame for
+    writer_config.backpressure = Backpressure::BLOCK;
+
+    const char *usage = "usage: %s [-j jobs] [-c jpegls|packed] [-n near] [-t telemetry_rows] [-s] [-k keep_every] [-d downscale] [-K tlinear|calibration_table] [-D] input output\n"
+            "  -s strips the telemetry split off with -t, or already split in the recording";
+
+    int ch;
+    while (ch = getopt(argc, argv, "j:c:n:t:sk:d:K:D"), ch != -1)
+    {
+        switch (ch)
+        {
+        case 'j':
+            jobs = std::stoul(optarg);
+            break;
+        case 'c':
+            if (!strcmp(optarg, "jpegls"))
+                ret.compression = VideoFrame::Compression::JPEG_LS;
+            else if (!strcmp(optarg, "packed"))
+                ret.compression = VideoFrame::Compression::PACKED;
+            else
+                errx(1, "codec must be jpegls or packed");
+
+            ret.reencode = true;
+            break;
+        case 'n':
+            near = std::stoi(optarg);
+            ret.reencode = true;
+            break;
+        case 't':
+            // Rows below the image, split off and stored raw
+            telemetry_rows = std::stoi(optarg);
+            ret.reencode = true;
+            break;
+        case 's':
+            ret.strip_telemetry = true;
+            ret.reencode = true;
+            break;
+        case 'k':
+            ret.decimate = std::max(1ul, std::stoul(optarg));
+            break;
+        case 'd':
+            downscale = std::stoi(optarg);
+
+            if (downscale != 1 && downscale != 2 && downscale != 4)
+                errx(1, "downscale must be 1, 2 or 4");
+
+            ret.reencode |= downscale > 1;
+            break;
+        case 'K':
+            // Counts to centikelvin, either the camera's TLinear scale or a
+            // "counts kelvin" table
+            calibration = optarg;
+            ret.reencode = true;
+            break;
+        case 'D':
+            writer_config.direct_io = true;
+            break;
+        case '?':
+            errx(1, usage, *argv);
+        }
+    }
+
+    if (argc - optind < 2)
+        errx(1, usage, *argv);
+
+    if (near && ret.compression != VideoFrame::Compression::JPEG_LS)
+        warnx("near only applies to jpegls, ignored");
+
+    if (!jobs)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    // Room for a whole batch while the previous one is still being written,
+    // so handing a batch over only blocks when the disk is the bottleneck
+    writer_config.queue_size = std::max(writer_config.queue_size, 2 * jobs * frames_per_worker);
+
+    ret.reader = open_video_reader(argv[optind]);
+
+    // Inline sensor rows are only telemetry to us once split
+    if (ret.strip_telemetry && !telemetry_rows)
+    {
+        if (auto first = ret.reader->read_stored_frame(0); !first || !first->metadata.telemetry_rows)
+            errx(1, "-s needs -t, %s has no split telemetry", argv[optind]);
+    }
+    ret.writer = std::make_unique<VideoContainerWriter>(argv[optind + 1], writer_config);
+
+    ret.pool = std::make_unique<ThreadPool>(jobs);
+
+    for (size_t i = 0; i < jobs; i++)
+    {
+        auto transcoder = std::make_unique<Transcoder>();
+
+        if (telemetry_rows)
+            transcoder->splitter = std::make_unique<TelemetrySplitter>(telemetry_rows);
+
+        if (!calibration.empty())
+        {
+            transcoder->radiometric = std::make_unique<RadiometricConverter>();
+
+            if (calibration != "tlinear" && !transcoder->radiometric->load_table(calibration))
+                errx(1, "cannot load calibration table %s", calibration.c_str());
+        }
+
+        if (downscale > 1)
+            transcoder->downscaler = std::make_unique<Downscaler>(downscale);
+
+        transcoder->encoder.set_near_lossless(near);
+
+        ret.transcoders.push_back(std::move(transcoder));
+    }
+
+    return ret;
+}
+
+// Runs on a worker, reads stored frame idx and turns it into what is written
+auto transcode_frame(const TranscodeContext &ctx, Transcoder &transcoder, size_t idx) -> VideoFramePtr
+{
+    auto frame = ctx.reader->read_stored_frame(idx);
+
+    if (!frame)
+        return nullptr;
+
+    transcoder.bytes_in += frame->buffer.size();
+
+    if (!ctx.reencode)
+        return frame;
+
+    frame = transcoder.decoder.process_frame(frame);
+    frame = transcoder.unpacker.process_frame(frame);
+
+    if (transcoder.splitter)
+        frame = transcoder.splitter->process_frame(frame);
+
+    if (auto &metadata = frame->metadata; ctx.strip_telemetry && metadata.telemetry_size)
+    {
+        frame->buffer.resize(std::min<size_t>(frame->buffer.size(), metadata.telemetry_offset));
+        metadata.telemetry_rows = 0;
+        metadata.telemetry_offset = 0;
+        metadata.telemetry_size = 0;
+    }
+
+    if (transcoder.radiometric)
+        frame = transcoder.radiometric->process_frame(frame);
+
+    if (transcoder.downscaler && !(frame = transcoder.downscaler->process_frame(frame)))
+        return nullptr;
+
+    bool format_changed = memcmp(&frame->format, &transcoder.encoder_format, sizeof frame->format) != 0;
+    transcoder.encoder_format = frame->format;
+
+    if (ctx.compression == VideoFrame::Compression::PACKED)
+    {
+        if (format_changed)
+            transcoder.packer.set_frame_format(frame->format);
+
+        return transcoder.packer.process_frame(frame);
+    }
+
+    if (format_changed)
+        transcoder.encoder.set_frame_format(frame->format);
+
+    return transcoder.encoder.process_frame(frame);
+}
+
+static auto seconds_since(std::chrono::steady_clock::time_point start) -> double
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    auto ctx = create_context(argc, argv);
+
+    configure_current_thread("transcode");
+
+    const size_t num_workers = ctx.transcoders.size();
+    const size_t num_frames = (ctx.reader->num_frames() + ctx.decimate - 1) / ctx.decimate;
+
+    // Workers take every num_workers-th frame of a batch, the batch is then
+    // queued in order and written by the writer's I/O thread while the next
+    // one is transcoded
+    std::vector<VideoFramePtr> batch(num_workers * frames_per_worker);
+
+    uint64_t bytes_out = 0;
+    size_t frames_out = 0;
+    const auto start = std::chrono::steady_clock::now();
+    double last_report = 0;
+
+    auto bytes_in = [&]() {
+        uint64_t ret = 0;
+
+        for (const auto &transcoder : ctx.transcoders)
+            ret += transcoder->bytes_in;
+
+        return ret;
+    };
+
+    for (size_t first = 0; first < num_frames; first += batch.size())
+    {
+        size_t count = std::min(batch.size(), num_frames - first);
+
+        ctx.pool->parallel_for(num_workers, [&](size_t worker) {
+            for (size_t i = worker; i < count; i += num_workers)
+                batch[i] = transcode_frame(ctx, *ctx.transcoders[worker], (first + i) * ctx.decimate);
+        });
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!batch[i])
+            {
+                warnx("frame %zu unreadable, skipped", (first + i) * ctx.decimate);
+                continue;
+            }
+
+            bytes_out += batch[i]->buffer.size();
+            frames_out++;
+
+            ctx.writer->write_frame(batch[i]);
+            batch[i] = nullptr;
+        }
+
+        if (double elapsed = seconds_since(start); elapsed - last_report >= 1)
+        {
+            printf("%zu/%zu frames, %.1f fps, in %.1f MB/s, out %.1f MB/s\n", first + count, num_frames,
+                    (first + count) / elapsed, bytes_in() / elapsed / 1e6, bytes_out / elapsed / 1e6);
+            last_report = elapsed;
+        }
+    }
+
+    // Only done once everything is on disk, write errors are reported by the
+    // writer
+    ctx.writer.reset();
+
+    double elapsed = seconds_since(start);
+
+    printf("%zu frames in %.2f s with %zu workers: %.1f fps, in %.1f MB/s, out %.1f MB/s, size %.1f%%\n",
+            frames_out, elapsed, num_workers, frames_out / elapsed, bytes_in() / elapsed / 1e6, bytes_out / elapsed / 1e6,
+            bytes_in() ? 100.0 * bytes_out / bytes_in() : 0.0);
+
+    return 0;
+}